@@ -5,6 +5,8 @@
 #include "tools.h"
 #include "menu.h"
 
+#include "profiler.h"
+
 static bool showFps = false;
 static bool showMem = false;
 static bool showBuffers = false;
@@ -93,6 +95,8 @@ void coreRun(void(*mainLoopFunc)())
 		
 		displaySystemInfo();
 
+		PROFILE_BEGIN(PROFILE_DISPLAY);
 		displayScreen();
+		PROFILE_END(PROFILE_DISPLAY);
 	}
 }
@@ -35,15 +35,20 @@ void initInput()
 	mousePosition.y = 0;
 }
 
-static void updateJoypad()
+static int readJoypadBits(int pad)
 {
-	int i, joybits;
-
 	ControlPadEventData cpaddata;
 	cpaddata.cped_ButtonBits=0;
-	GetControlPad(1,0,&cpaddata);
+	GetControlPad(pad,0,&cpaddata);
+
+	return cpaddata.cped_ButtonBits;
+}
+
+static void updateJoypad()
+{
+	int i, joybits;
 
-	joybits = cpaddata.cped_ButtonBits;
+	joybits = readJoypadBits(1);
 
 	anyJoyButtonPressed = false;
 	for (i=0; i<JOY_BUTTONS_NUM; ++i) {
@@ -82,6 +87,17 @@ static void updateMouse()
 	}
 }
 
+void pollJoyButtons(int pad, bool *pressed)
+{
+	// the pad (counting from 1 along the daisy chain) right now, what updateInput tracks is left alone
+	const int joybits = readJoypadBits(pad);
+	int i;
+
+	for (i=0; i<JOY_BUTTONS_NUM; ++i) {
+		pressed[i] = (joybits & joyButtonHwIDs[i]) != 0;
+	}
+}
+
 MousePosition getMousePosition()
 {
 	return mousePosition;
@@ -26,6 +26,7 @@ bool isJoyButtonPressed(int joyButtonId);
 bool isJoyButtonPressedOnce(int joyButtonId);
 bool isMouseButtonPressed(int mouseButtonId);
 bool isMouseButtonPressedOnce(int mouseButtonId);
+void pollJoyButtons(int pad, bool *pressed);
 
 MousePosition getMousePosition(void);
 
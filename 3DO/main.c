@@ -0,0 +1,586 @@
+/*
+ * LameNES - Nintendo Entertainment System (NES) emulator
+ *
+ * Copyright (c) 2005, Joey Loman, <joey@lamenes.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "core.h"
+#include "input.h"
+#include "system_graphics.h"
+#include "tools.h"
+
+#include "lamenes.h"
+#include "ppu.h"
+#include "nes_input.h"
+#include "memory.h"
+#include "rewind.h"
+#include "movie.h"
+#include "profiler.h"
+
+#define MAX_FILES_NUM 1024
+#define MAX_FILENAME_LENGTH 256
+
+// played by C+LPAD when no movie was recorded this session
+#define MOVIE_FILENAME "Movies/movie.lnmv"
+
+bool pause_emulation = false;
+
+// 0-3 frames skipped after each rendered one, or FRAMESKIP_AUTO to follow the measured frame time
+#define FRAMESKIP_AUTO 4
+#define FRAMESKIP_AUTO_MAX 5
+// frames measured before the auto frameskip level is reconsidered
+#define FRAMESKIP_AUTO_WINDOW 32
+
+int frameskipNum = 0;
+static int autoFrameskipLevel = 0;
+bool skipRendering = false;
+
+
+static int currentFrameskip()
+{
+	if (frameskipNum == FRAMESKIP_AUTO) return autoFrameskipLevel;
+	return frameskipNum;
+}
+
+static void drawFrameskipDots(int num, bool autoLevel)
+{
+	int i;
+	for (i=0; i<FRAMESKIP_AUTO_MAX; ++i) {
+		const int c = i + 1;
+		uint16 color = 0;
+		if (i < num) {
+			color = autoLevel ? MakeRGB15(7, 23, 31) : MakeRGB15(7 + (c << 3), 3 + (c << 2), c << 1);
+		}
+		drawThickPixel(2*(i+1), 116, color);
+	}
+}
+
+static void updateAutoFrameskip(int frameTicks, bool rendered)
+{
+	// Rendered frames cost CPU and rendering, skipped ones only CPU (never skipped), so the two costs come out of the frame times.
+	// The level goes up as soon as frames take longer than the refresh period, and down only when the lower level
+	// is predicted to leave an eighth of the period spare, so it doesn't bounce between two levels.
+	static int frames = 0, renderedFrames = 0;
+	static int renderedTicks = 0, skippedTicks = 0;
+	const int periodUs = (systemType == SYSTEM_PAL) ? 20000 : 16667;
+	int renderedUs, cpuUs, renderUs, frameUs;
+
+	if (rendered) {
+		renderedFrames++;
+		renderedTicks += frameTicks;
+	} else {
+		skippedTicks += frameTicks;
+	}
+	if (++frames < FRAMESKIP_AUTO_WINDOW) return;
+
+	frameUs = ((renderedTicks + skippedTicks) * 1000) / frames;
+	renderedUs = renderedFrames ? (renderedTicks * 1000) / renderedFrames : frameUs;
+	// with no skipped frame in the window there is nothing to split, it all counts as CPU
+	cpuUs = (frames > renderedFrames) ? (skippedTicks * 1000) / (frames - renderedFrames) : renderedUs;
+	renderUs = renderedUs - cpuUs;
+	if (renderUs < 0) renderUs = 0;
+
+	if (frameUs > periodUs) {
+		if (autoFrameskipLevel < FRAMESKIP_AUTO_MAX) autoFrameskipLevel++;
+	} else if (autoFrameskipLevel > 0) {
+		// one rendered frame every autoFrameskipLevel frames instead of every autoFrameskipLevel + 1
+		if (cpuUs + renderUs / autoFrameskipLevel <= periodUs - (periodUs >> 3)) autoFrameskipLevel--;
+	}
+
+	// level in the lower left dots, headroom left in the period (percent, negative when too slow) under them
+	drawFrameskipDots(autoFrameskipLevel, true);
+	drawNumber(0, 124, ((periodUs - frameUs) * 100) / periodUs);
+
+	frames = renderedFrames = 0;
+	renderedTicks = skippedTicks = 0;
+}
+
+static void drawTileCacheStats()
+{
+	// hit ratio (percent) and memory used (KB) every 64 frames, under the frameskip headroom
+	static int frames = 0;
+	const unsigned int lookups = tile_cache_hits + tile_cache_misses;
+
+	if (++frames < 64) return;
+	frames = 0;
+
+	drawNumber(0, 140, lookups ? (int)((tile_cache_hits * 100) / lookups) : 0);
+	drawNumber(0, 148, tile_cache_memory() >> 10);
+
+	tile_cache_hits = tile_cache_misses = 0;
+}
+
+static void drawRunAheadCost(uint32 us)
+{
+	// average run-ahead cost per frame (microseconds) every 32 frames, under the frameskip headroom
+	static int frames = 0;
+	static uint32 totalUs = 0;
+
+	totalUs += us;
+	if (++frames < 32) return;
+
+	drawNumber(0, 132, totalUs / frames);
+	frames = 0;
+	totalUs = 0;
+}
+
+#if PROFILER
+// a column per profiled frame along the bottom of the screen, newest on the right
+#define PROFILER_BAR_X ((SCREEN_WIDTH - PROFILER_FRAMES) / 2)
+#define PROFILER_BAR_HEIGHT 40
+#define PROFILER_US_PER_PIXEL 500
+
+static void drawProfilerOverlay()
+{
+	// the sections stacked from the bottom in enum order, each column cleared above its bar
+	static const char *labels[PROFILE_SECTIONS_NUM] = { "CPU", "SCN", "BG", "SPR", "PAL", "CEL", "DSP" };
+	const uint16 colors[PROFILE_SECTIONS_NUM] = {
+		MakeRGB15(31, 7, 7), MakeRGB15(31, 23, 7), MakeRGB15(7, 31, 7), MakeRGB15(7, 23, 31),
+		MakeRGB15(23, 7, 31), MakeRGB15(31, 31, 7), MakeRGB15(15, 15, 15)
+	};
+	const int frames = profile_frames();
+	const int bottom = SCREEN_HEIGHT - 1;
+	int age, i, y, x = PROFILER_BAR_X;
+
+	for (i=0; i<PROFILE_SECTIONS_NUM; ++i) {
+		setTextColor(colors[i]);
+		drawText(x, bottom - PROFILER_BAR_HEIGHT - 8, (char*)labels[i]);
+		x += (strlen(labels[i]) + 1) * FONT_WIDTH;
+	}
+	setTextColor(MakeRGB15(31, 31, 31));
+
+	for (age=0; age<PROFILER_FRAMES; ++age) {
+		const int px = PROFILER_BAR_X + PROFILER_FRAMES - 1 - age;
+		int height = 0;
+
+		if (age < frames) {
+			const uint16 *frame = profile_frame(age);
+			int totalUs = 0;
+
+			for (i=0; i<PROFILE_SECTIONS_NUM; ++i) {
+				// from the running total, so short sections don't all round away
+				int top;
+				totalUs += frame[i];
+				top = totalUs / PROFILER_US_PER_PIXEL;
+				if (top > PROFILER_BAR_HEIGHT) top = PROFILER_BAR_HEIGHT;
+
+				for (; height<top; ++height) {
+					drawPixel(px, bottom - height, colors[i]);
+				}
+			}
+		}
+		for (y=height; y<PROFILER_BAR_HEIGHT; ++y) {
+			drawPixel(px, bottom - y, 0);
+		}
+	}
+}
+#endif
+
+static void updateMovieDot()
+{
+	// red while recording a movie, green while playing one
+	static int shownState = MOVIE_OFF;
+	const int state = movie_state();
+	uint16 color = 0;
+
+	if (state == shownState) return;
+	shownState = state;
+
+	if (state == MOVIE_RECORDING) {
+		color = MakeRGB15(31, 7, 7);
+	} else if (state == MOVIE_PLAYING) {
+		color = MakeRGB15(7, 31, 7);
+	}
+	drawThickPixel(150, 2, color);
+}
+
+static bool runControlChord()
+{
+	// Held C with another button. Resets and power cycles go through movie_event so a recording movie replays them,
+	// a movie playing has its own. The disc is read only, a movie only lives until the next one is recorded.
+	const bool playing = movie_state() == MOVIE_PLAYING;
+
+	if (isJoyButtonPressedOnce(JOY_BUTTON_START)) {
+		if (!playing) movie_event(MOVIE_EVENT_RESET);
+	} else if (isJoyButtonPressedOnce(JOY_BUTTON_SELECT)) {
+		if (!playing) movie_event(MOVIE_EVENT_POWER);
+	} else if (isJoyButtonPressedOnce(JOY_BUTTON_A)) {
+		movie_record(false);
+	} else if (isJoyButtonPressedOnce(JOY_BUTTON_B)) {
+		movie_record(true);
+	} else if (isJoyButtonPressedOnce(JOY_BUTTON_LPAD)) {
+		// the last movie recorded or played, else the one on the disc
+		int size;
+		const uint8 *data = movie_data(&size);
+
+		if (!data || !movie_play(data, size)) {
+			movie_load(MOVIE_FILENAME);
+		}
+	} else if (isJoyButtonPressedOnce(JOY_BUTTON_RPAD)) {
+		movie_stop();
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static bool runEmulationFrame()
+{
+	static int frame = 0;
+
+	const bool render = !(frame || skipRendering);
+
+	run_frame(render, true);
+
+	if (runAheadFrames > 0 && render) {
+		drawRunAheadCost(run_ahead_us);
+	}
+
+	frame = (frame + 1) % (currentFrameskip() + 1);
+
+	return render;
+}
+
+void runEmu()
+{
+	// time between two calls covers the whole previous frame, display included
+	static int prevTicks = 0;
+	static bool prevRendered = false;
+	// C is the chord key, alone it cycles the frameskip when let go
+	static bool chordKeyHeld = false;
+	static bool chordUsed = false;
+	const bool chordKey = isJoyButtonPressed(JOY_BUTTON_C);
+	bool rewinding = false;
+	const int ticks = getTicks();
+
+	if (DEBUG_MEM_FREQS) {
+		mr_nohw = 0;
+		mr_hw = 0;
+		mr_0x2002 = 0;
+		mr_0x2007 = 0;
+		mr_0x4016 = 0;
+		mw_other = 0;
+		mw_ppu = 0;
+		mw_0x2002 = 0;
+		mw_0x4014 = 0;
+		mw_0x4016 = 0;
+		mw_mirror_low = 0;
+
+		mw_ppu_0x2000 = 0;
+		mw_ppu_0x2001 = 0;
+		mw_ppu_0x2003 = 0;
+		mw_ppu_0x2004 = 0;
+		mw_ppu_0x2005 = 0;
+		mw_ppu_0x2006 = 0;
+		mw_ppu_0x2007 = 0;
+		mw_ppu_0x4014 = 0;
+	}
+	
+	if (chordKey) {
+		if (!chordKeyHeld) chordUsed = false;
+		if (runControlChord()) chordUsed = true;
+	}
+
+	// Frameskip to speed up things for testing
+	if (!chordKey && chordKeyHeld && !chordUsed) {
+		frameskipNum = (frameskipNum + 1) % (FRAMESKIP_AUTO + 1);
+		if (frameskipNum == FRAMESKIP_AUTO) {
+			autoFrameskipLevel = 0;
+			drawFrameskipDots(autoFrameskipLevel, true);
+		} else {
+			drawFrameskipDots(frameskipNum, false);
+			drawText(0, 124, "    ");
+		}
+	} else if (frameskipNum == FRAMESKIP_AUTO && !pause_emulation) {
+		updateAutoFrameskip(ticks - prevTicks, prevRendered);
+	}
+	prevTicks = ticks;
+	chordKeyHeld = chordKey;
+
+	// Holding it rewinds when there is a rewind history, else no rendering emulation (to purely benchmark CPU)
+	if (rewind_enabled()) {
+		// going back would break a movie
+		rewinding = isJoyButtonPressed(JOY_BUTTON_LPAD) && !chordKey && movie_state() == MOVIE_OFF;
+	} else {
+		skipRendering = isJoyButtonPressed(JOY_BUTTON_LPAD) && !chordKey;
+	}
+
+	// Pause CPU execution (to benchmark rendering of the last frame only);
+	//skipCPU = isJoyButtonPressed(JOY_BUTTON_RPAD);
+
+	// I will steal this button to cycle between the more accurate and the faster renderer, in direct and then indexed output
+	if (isJoyButtonPressedOnce(JOY_BUTTON_RPAD) && !chordKey) {
+		uint16 color = 0;
+		if (renderer == RENDERER_PER_LINE) {
+			color = MakeRGB15(7, 31, 15);
+			renderer = RENDERER_PER_TILE;
+		} else {
+			renderer = RENDERER_PER_LINE;
+			outputMode = (outputMode == OUTPUT_DIRECT_16BPP) ? OUTPUT_INDEXED_8BPP : OUTPUT_DIRECT_16BPP;
+			// palmap32 wasn't kept up to date while indexed, and the other buffer holds an old frame
+			palette_dirty = 15;
+			invalidate_screen();
+		}
+		drawThickPixel(158, 2, color);
+		drawThickPixel(154, 2, (outputMode == OUTPUT_INDEXED_8BPP) ? MakeRGB15(31, 23, 7) : 0);
+	}
+
+	markHostInputPoll();
+
+	if (rewinding) {
+		// one rewind point back per displayed frame, each shown by running its first frame
+		if (rewind_step_back()) {
+			prevRendered = runEmulationFrame();
+		}
+	} else if (!pause_emulation) {
+		prevRendered = runEmulationFrame();
+		rewind_frame_done();
+	}
+
+	updateMovieDot();
+
+	if (tile_cache_enabled) {
+		drawTileCacheStats();
+	}
+
+#if PROFILER
+	drawProfilerOverlay();
+#endif
+
+	if (INPUT_LATENCY_TEST) {
+		drawNumber(0, 156, input_latency_cycles);
+		drawNumber(0, 164, input_host_poll_age);
+	}
+
+	if (DEBUG_MEM_FREQS) {
+		drawNumber(0, 8, mr_nohw);		// 1000
+		drawNumber(0, 16, mr_hw);		// 1000
+
+		drawNumber(0, 32, mr_0x2002);	// 1000
+		drawNumber(0, 40, mr_0x2007);	// 0
+		drawNumber(0, 48, mr_0x4016);	// 8
+
+
+		drawNumber(0, 64, mw_other);	// 650
+		drawNumber(0, 72, mw_ppu);		// 12
+
+		drawNumber(0, 88, mw_0x2002);	// 2000
+		drawNumber(0, 96, mw_0x4014);	// 1
+		drawNumber(0, 104, mw_0x4016);	// 2
+		drawNumber(0, 112, mw_mirror_low);	// 650
+
+		drawNumber(0, 152, mw_ppu_0x2000);
+		drawNumber(0, 160, mw_ppu_0x2001);
+		drawNumber(0, 168, mw_ppu_0x2003);
+		drawNumber(0, 176, mw_ppu_0x2004);
+		drawNumber(0, 184, mw_ppu_0x2005);
+		drawNumber(0, 192, mw_ppu_0x2006);
+		drawNumber(0, 200, mw_ppu_0x2007);
+		drawNumber(0, 208, mw_ppu_0x4014);
+	}
+}
+
+int returnStringLength(char *str)
+{
+	int i = 0;
+	while (i < MAX_FILENAME_LENGTH) {
+		if (*str++ == 0) return i;
+		++i;
+	}
+	return -1;
+}
+
+void showHelpScreen()
+{
+	const uint16 titleColor = MakeRGB15(31, 24, 15);
+	const uint16 textColor = MakeRGB15(24, 28, 31);
+	const uint16 specialColor = MakeRGB15(7, 31, 7);
+	const uint16 bluerColor = MakeRGB15(7, 15, 31);
+	const uint16 bugoColor = MakeRGB15(31, 15, 7);
+
+	while(!wasAnyJoyButtonPressed()) {
+
+		updateInput();
+
+		setTextColor(titleColor);
+		drawTextX2(32, 16, "Not So LameNES");
+		drawTextX2(32, 32, "--------------");
+
+		setTextColor(textColor);
+		drawText(8, 64, "Here are the instructions..");
+
+		setTextColor(specialColor);	drawText(0, 80, "DPAD, A, B, select start");
+		setTextColor(textColor);	drawText(8, 88, "matches the NES gamepad");
+
+		setTextColor(specialColor);	drawText(0, 104, "Press C");
+		setTextColor(textColor);	drawText(8, 112, "toggle 0-3 frameskip then auto");
+									drawText(8, 120, "look dots on the lower left");
+
+		setTextColor(specialColor);	drawText(0, 136, "Hold LPAD");
+		setTextColor(textColor);	drawText(8, 144, "rewinds (CPU only if rewind is off)");
+
+		setTextColor(specialColor);	drawText(0, 160, "Press RPAD");
+		setTextColor(textColor);	drawText(8, 168, "switch faster renderer (incompatible)");
+									drawText(8, 176, "Works with Mario but fails with rest");
+									drawText(8, 184, "dot in upper right if fast renderer on");
+									drawText(8, 192, "and left of it if 8bpp indexed");
+
+		setTextColor(specialColor);	drawText(0, 200, "Hold C with START/SELECT");
+		setTextColor(textColor);	drawText(8, 208, "reset/power, A/B record from power/now");
+									drawText(8, 216, "LPAD play, RPAD stop the movie");
+
+		setTextColor(bluerColor);
+		drawText(16, 224, "Press any button to continue!");
+		setTextColor(bugoColor); drawText(96, 232, "Bugo the Cat signing off..");
+
+		displayScreen();
+	}
+	clearAllBuffers();
+}
+
+char *selectFileFromMenu()
+{
+	int i;
+	char *romsDirectory = "Roms";
+	uint32 fileCount;
+	char *fileStr[MAX_FILES_NUM];
+
+	Directory      *dir;
+	DirectoryEntry  de;
+	char *selectedRom = NULL;
+	char dirRom[MAX_FILENAME_LENGTH + 4 + 1];
+
+	Item dirItem = OpenDiskFile(romsDirectory);
+	int selectIndex = 0;
+	const int maxFilesPerScreen = 30;
+	bool firstUpdate = true;
+	int prevFilePage = 0;
+	
+	const uint16 colorWhite = MakeRGB15(31, 31, 31);
+	const uint16 colorGrey = MakeRGB15(15, 15, 15);
+
+	// Read all the files from the Roms directory
+    dir = OpenDirectoryItem(dirItem);
+	fileCount = 0;
+	while (ReadDirectory(dir, &de) >= 0 && fileCount < MAX_FILES_NUM)
+	{
+		if (!(de.de_Flags & FILE_IS_DIRECTORY)) {
+			const int fileStrLen = returnStringLength(de.de_FileName);
+			if (fileStrLen > 0 && fileStrLen <= MAX_FILENAME_LENGTH) {
+				fileStr[fileCount] = (char*)AllocMem(fileStrLen, MEMTYPE_TRACKSIZE);
+				sprintf(fileStr[fileCount], "%s\0", de.de_FileName);
+				fileCount++;
+			}
+		}
+	}
+	CloseDirectory(dir);
+
+	// Main rom selection menu
+	while(!selectedRom) {
+
+		updateInput();
+
+		if (isJoyButtonPressedOnce(JOY_BUTTON_DOWN)) {
+			if (selectIndex < fileCount-1) ++selectIndex;
+		}
+		if (isJoyButtonPressedOnce(JOY_BUTTON_UP)) {
+			if (selectIndex > 0) --selectIndex;
+		}
+		if (isJoyButtonPressedOnce(JOY_BUTTON_LPAD)) {
+			selectIndex -= maxFilesPerScreen;
+			if (selectIndex < 0) selectIndex = 0;
+		}
+		if (isJoyButtonPressedOnce(JOY_BUTTON_RPAD)) {
+			selectIndex += maxFilesPerScreen;
+			if (selectIndex > fileCount-1) selectIndex = fileCount-1;
+		}
+		if (isJoyButtonPressedOnce(JOY_BUTTON_A)) {
+			selectedRom = fileStr[selectIndex];
+		}
+
+		if (wasAnyJoyButtonPressed() || firstUpdate) {
+			const int filePage = selectIndex / maxFilesPerScreen;
+			const int pageStartIndex = filePage * maxFilesPerScreen;
+
+			if (filePage != prevFilePage) clearAllBuffers();
+			prevFilePage = filePage;
+
+			for (i=0; i<maxFilesPerScreen; ++i) {
+				const int realIndex = pageStartIndex + i;
+
+				uint16 color = colorGrey;
+				if (selectIndex == realIndex) {
+					color = colorWhite;
+				}
+
+				if (realIndex < fileCount) {
+					setTextColor(color);
+					drawText(0, i*8, fileStr[realIndex]);
+				}
+			}
+
+			displayScreen();
+			firstUpdate = false;
+		}
+	}
+
+
+	clearAllBuffers();
+	setTextColor(colorWhite);
+
+	// Create the full rom folder/file string
+	sprintf(dirRom, "%s/%s\0", romsDirectory, selectedRom);
+
+	// Free all the filename strings allocated
+	for (i=0; i<fileCount; ++i) {
+		FreeMem(fileStr[i], -1);
+	}
+
+	return dirRom;
+}
+
+void initEmu()
+{
+	char *filename = NULL;
+
+	showHelpScreen();
+
+	filename = selectFileFromMenu();
+	if (!filename || !load_game(filename)) {
+		exit(1);
+	}
+}
+
+int main()
+{
+	coreInit(initEmu, CORE_VRAM_SINGLEBUFFER | CORE_NO_CLEAR_FRAME | CORE_SHOW_FPS | CORE_NO_VSYNC);
+	coreRun(runEmu);
+}
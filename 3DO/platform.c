@@ -0,0 +1,210 @@
+#include "core.h"
+
+#include "input.h"
+#include "system_graphics.h"
+#include "tools.h"
+
+#include <filestreamfunctions.h>
+
+#include "lamenes.h"
+#include "ppu.h"
+#include "nes_input.h"
+#include "platform.h"
+#include "profiler.h"
+
+
+static CCB *screenCel;
+static CCB *screenRowCel[32];
+static CCB *screenCel8;
+static CCB *screenRowCel8[32];
+
+// NES pad bit of each 3DO/input.h JOY_BUTTONS enum, C and the shoulder buttons stay with the emulator
+static const unsigned char joyButtonsMap[JOY_BUTTONS_NUM] = { 
+	PAD_UP, PAD_DOWN, PAD_LEFT, PAD_RIGHT,
+	PAD_B, PAD_A,
+	0, 0, 0,
+	PAD_SELECT, PAD_START
+};
+
+
+void *platform_alloc(int size)
+{
+	return AllocMem(size, MEMTYPE_ANY | MEMTYPE_TRACKSIZE);
+}
+
+void platform_free(void *p)
+{
+	if (p) FreeMem(p, -1);
+}
+
+int platform_ticks()
+{
+	return getTicks();
+}
+
+uint32 platform_usec()
+{
+	return getMicroTicks();
+}
+
+PlatformFile *platform_file_open(char *name)
+{
+	return (PlatformFile*)OpenDiskStream(name, 0);
+}
+
+int platform_file_size(PlatformFile *f)
+{
+	const int size = SeekDiskStream((Stream*)f, 0, SEEK_END);
+
+	SeekDiskStream((Stream*)f, 0, SEEK_SET);
+	return size;
+}
+
+int platform_file_read(PlatformFile *f, void *dst, int size)
+{
+	return ReadDiskStream((Stream*)f, (char*)dst, size);
+}
+
+void platform_file_close(PlatformFile *f)
+{
+	CloseDiskStream((Stream*)f);
+}
+
+bool platform_file_write(char *name, const void *data, int size)
+{
+	// the disc is read only
+	return false;
+}
+
+unsigned char platform_read_pad(int pad)
+{
+	// pads count from 1 along the daisy chain
+	bool pressed[JOY_BUTTONS_NUM];
+	unsigned char bits = 0;
+	int i;
+
+	pollJoyButtons(pad + 1, pressed);
+
+	// C held on the first pad makes a chord for the emulator (3DO/main.c), the game and any movie recording see no buttons
+	if (pad == 0 && pressed[JOY_BUTTON_C]) return 0;
+
+	for (i=0; i<JOY_BUTTONS_NUM; ++i) {
+		if (pressed[i]) bits |= joyButtonsMap[i];
+	}
+	return bits;
+}
+
+
+
+static void initNESscreenCELs(int nesWidth, int nesHeight)
+{
+	int y;
+	const uint32 width = nesWidth + 8;
+	const uint32 height = nesHeight + 8;
+
+	screenCel = CreateCel(width, height, 16, CREATECEL_UNCODED, NULL);
+	screenCel->ccb_Flags |= (CCB_LAST | CCB_BGND);
+	screenCel->ccb_XPos = 32 << 16;
+
+	for (y=0; y<32; ++y) {
+		screenRowCel[y] = CreateCel(width, 8, 16, CREATECEL_UNCODED, (uint16*)screenCel->ccb_SourcePtr + y * width * 8);
+		screenRowCel[y]->ccb_XPos = screenCel->ccb_XPos;
+		screenRowCel[y]->ccb_YPos = (y * 8) << 16;
+		screenRowCel[y]->ccb_Flags = screenCel->ccb_Flags & ~CCB_LAST;
+		if (y!=0) LinkCel(screenRowCel[y-1], screenRowCel[y]);
+	}
+	screenRowCel[31]->ccb_Flags |= CCB_LAST;
+
+	// same layout with one byte per pixel, palette indices 0-31 go straight through the row PLUT
+	screenCel8 = CreateCel(width, height, 8, CREATECEL_CODED, NULL);
+	screenCel8->ccb_Flags |= (CCB_LAST | CCB_BGND);
+	screenCel8->ccb_XPos = screenCel->ccb_XPos;
+
+	for (y=0; y<32; ++y) {
+		screenRowCel8[y] = CreateCel(width, 8, 8, CREATECEL_CODED, (uint8*)screenCel8->ccb_SourcePtr + y * width * 8);
+		screenRowCel8[y]->ccb_PLUTPtr = (PLUTChunk*)row_palette[y];
+		screenRowCel8[y]->ccb_XPos = screenCel8->ccb_XPos;
+		screenRowCel8[y]->ccb_YPos = (y * 8) << 16;
+		screenRowCel8[y]->ccb_Flags = screenCel8->ccb_Flags & ~CCB_LAST;
+		if (y!=0) LinkCel(screenRowCel8[y-1], screenRowCel8[y]);
+	}
+	screenRowCel8[31]->ccb_Flags |= CCB_LAST;
+}
+
+static void updateSmoothScrollingRow(int charLine)
+{
+	const uint32 scrollX = scrollRowX[charLine] & 7;
+	CCB *rowCel = (outputMode == OUTPUT_INDEXED_8BPP) ? screenRowCel8[charLine] : screenRowCel[charLine];
+
+	rowCel->ccb_PRE0 = (rowCel->ccb_PRE0 & ~(255U << 24)) | (scrollX << 24);
+	rowCel->ccb_PRE1 = (rowCel->ccb_PRE1 & ~PRE1_TLHPCNT_MASK) | (NES_screen_width + scrollX - 1);
+}
+
+static void updateSmoothScrolling()
+{
+	int y;
+	for (y=0; y<32; ++y) {
+		updateSmoothScrollingRow(y);
+	}
+}
+
+static void updateRowSkipping(bool rendered)
+{
+	// Rows whose lines all kept their signature (and PLUT) are still on the screen from the previous frame, the CEL engine skips them.
+	// Skipped frames change nothing at all.
+	CCB **rowCels = (outputMode == OUTPUT_INDEXED_8BPP) ? screenRowCel8 : screenRowCel;
+	int y, line;
+
+	for (y=0; y<32; ++y) {
+		bool changed = present_all_rows;
+
+		if (rendered) {
+			if (row_palette_changed[y]) changed = true;
+			for (line = y << 3; line < (y << 3) + 8 && line < NES_screen_height; ++line) {
+				if (line_changed[line]) changed = true;
+			}
+		}
+		row_palette_changed[y] = false;
+
+		if (changed) {
+			rowCels[y]->ccb_Flags &= ~CCB_SKIP;
+		} else {
+			rowCels[y]->ccb_Flags |= CCB_SKIP;
+		}
+	}
+	present_all_rows = false;
+}
+
+static void drawNESscreenCELs()
+{
+	if (outputMode == OUTPUT_INDEXED_8BPP) {
+		drawCels(screenRowCel8[0]);
+	} else {
+		drawCels(screenRowCel[0]);
+	}
+}
+
+bool platform_video_init(int width, int height)
+{
+	initNESscreenCELs(width, height);
+
+	screen.pixels = (uint16*)screenCel->ccb_SourcePtr;
+	screen.pixels8 = (uint8*)screenCel8->ccb_SourcePtr;
+	screen.pitch = screenCel->ccb_Width;
+	screen.width = width;
+	screen.height = height;
+
+	return true;
+}
+
+void platform_video_present(bool rendered)
+{
+	if (rendered) {
+		updateSmoothScrolling();
+	}
+	updateRowSkipping(rendered);
+
+	PROFILE_BEGIN(PROFILE_PRESENT);
+	drawNESscreenCELs();
+	PROFILE_END(PROFILE_PRESENT);
+}
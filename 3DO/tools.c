@@ -149,6 +149,11 @@ int getTicks()
 	return GetMSecTime(timerIOreq);
 }
 
+uint32 getMicroTicks()
+{
+	return GetUSecTime(timerIOreq);
+}
+
 void displayFPS()
 {
 	static int fps = 0, prevFrameNum = 0, prevTicks = 0;
@@ -27,6 +27,7 @@ void displayMem(void);
 void displayBuffers(void);
 
 int getTicks(void);
+uint32 getMicroTicks(void);
 
 void setPal(int c0, int c1, int r0, int g0, int b0, int r1, int g1, int b1, uint16* pal, int shr);
 void setPalWithFades(int c0, int c1, int r0, int g0, int b0, int r1, int g1, int b1, uint16* pal, int numFades, int r2, int g2, int b2);
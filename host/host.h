@@ -0,0 +1,15 @@
+/*
+ * host.h - what the headless platform offers the host programs besides platform.h
+ */
+
+#ifndef LAMENES_HOST_H
+#define LAMENES_HOST_H
+
+#include "platform.h"
+
+// the visible screen.width * screen.height picture as 0x00RRGGBB pixels
+extern void host_frame_rgb(uint32 *dst);
+// the picture the last platform_video_present showed, NULL before the first one
+extern const uint32 *host_presented_frame();
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * main.c - command line runner for host builds
+ *
+ * Runs a ROM headless for a number of frames, with the input of a movie if one is given.
+ * Build with "make headless", run as host/lamenes [options] rom.nes
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lamenes.h"
+#include "movie.h"
+#include "host.h"
+#include "profiler.h"
+
+static void usage()
+{
+	printf("usage: lamenes [options] rom.nes\n"
+		"  -f frames     frames to run (600)\n"
+		"  -m movie      play a movie, it also sets the frames if -f isn't given\n"
+		"  -r movie      record the frames run into a movie, from power on\n"
+		"  -n            don't render, CPU only\n"
+		"  -s file.ppm   write the last frame\n"
+#if PROFILER
+		"  -p file.csv   write the frame profile of the last frames\n"
+#endif
+		);
+}
+
+static bool writeScreenshot(char *filename)
+{
+	const uint32 *frame = host_presented_frame();
+	FILE *fp;
+	int i;
+
+	if (!frame) return false;
+
+	fp = fopen(filename, "wb");
+	if (!fp) return false;
+
+	fprintf(fp, "P6\n%d %d\n255\n", screen.width, screen.height);
+	for (i=0; i<screen.width * screen.height; ++i) {
+		unsigned char rgb[3];
+
+		rgb[0] = frame[i] >> 16;
+		rgb[1] = frame[i] >> 8;
+		rgb[2] = frame[i];
+		fwrite(rgb, 1, 3, fp);
+	}
+
+	return fclose(fp) == 0;
+}
+
+int main(int argc, char **argv)
+{
+	int frames = -1;
+	char *moviePlay = NULL;
+	char *movieRecord = NULL;
+	char *screenshot = NULL;
+#if PROFILER
+	char *profile = NULL;
+#endif
+	char *rom = NULL;
+	bool render = true;
+	int i, startTicks, ticks;
+
+	for (i=1; i<argc; ++i) {
+		if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			frames = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+			moviePlay = argv[++i];
+		} else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			movieRecord = argv[++i];
+		} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			screenshot = argv[++i];
+#if PROFILER
+		} else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			profile = argv[++i];
+#endif
+		} else if (!strcmp(argv[i], "-n")) {
+			render = false;
+		} else if (argv[i][0] != '-' && !rom) {
+			rom = argv[i];
+		} else {
+			usage();
+			return 2;
+		}
+	}
+	if (!rom) {
+		usage();
+		return 2;
+	}
+
+	if (!load_game(rom)) {
+		fprintf(stderr, "%s: can't load the ROM\n", rom);
+		return 1;
+	}
+
+	if (moviePlay) {
+		if (!movie_load(moviePlay)) {
+			fprintf(stderr, "%s: not a movie for this ROM\n", moviePlay);
+			return 1;
+		}
+		if (frames < 0) frames = movie_frames();
+	} else if (movieRecord) {
+		movie_record(false);
+	}
+	if (frames < 0) frames = 600;
+
+	startTicks = platform_ticks();
+	for (i=0; i<frames; ++i) {
+		run_frame(render, true);
+	}
+	ticks = platform_ticks() - startTicks;
+	// the last frame is only closed by the next one
+	PROFILE_NEXT_FRAME();
+
+	printf("%d frames in %d ms", frames, ticks);
+	if (ticks > 0) printf(", %.1f fps", frames * 1000.0 / ticks);
+	printf("\n");
+
+	if (movieRecord && !movie_save(movieRecord)) {
+		fprintf(stderr, "%s: can't write the movie\n", movieRecord);
+		return 1;
+	}
+	if (screenshot && !writeScreenshot(screenshot)) {
+		fprintf(stderr, "%s: can't write the screenshot\n", screenshot);
+		return 1;
+	}
+
+#if PROFILER
+	if (profile && !profile_write_csv(profile)) {
+		fprintf(stderr, "%s: can't write the profile\n", profile);
+		return 1;
+	}
+#endif
+
+	return 0;
+}
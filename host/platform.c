@@ -0,0 +1,143 @@
+/*
+ * platform.c - headless platform for host builds
+ *
+ * Presenting converts the screen to RGB in memory for the program running the core to look at, the
+ * pads are never pressed (movies bring the input) and files are stdio ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lamenes.h"
+#include "host.h"
+#include "profiler.h"
+
+static uint32 *presented = NULL;
+static bool presentedValid = false;
+
+
+void *platform_alloc(int size)
+{
+	return malloc(size);
+}
+
+void platform_free(void *p)
+{
+	free(p);
+}
+
+int platform_ticks()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+uint32 platform_usec()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+PlatformFile *platform_file_open(char *name)
+{
+	return (PlatformFile*)fopen(name, "rb");
+}
+
+int platform_file_size(PlatformFile *f)
+{
+	FILE *fp = (FILE*)f;
+	long size;
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	return (int)size;
+}
+
+int platform_file_read(PlatformFile *f, void *dst, int size)
+{
+	return (int)fread(dst, 1, size, (FILE*)f);
+}
+
+void platform_file_close(PlatformFile *f)
+{
+	fclose((FILE*)f);
+}
+
+bool platform_file_write(char *name, const void *data, int size)
+{
+	FILE *fp = fopen(name, "wb");
+	bool ok;
+
+	if (!fp) return false;
+
+	ok = fwrite(data, 1, size, fp) == (size_t)size;
+	if (fclose(fp) != 0) ok = false;
+
+	return ok;
+}
+
+unsigned char platform_read_pad(int pad)
+{
+	return 0;
+}
+
+bool platform_video_init(int width, int height)
+{
+	// the 3DO CELs' layout, 8 more pixels per line and 8 more lines
+	const int pitch = width + 8;
+	const int lines = height + 8;
+
+	free(screen.pixels);
+	free(screen.pixels8);
+	free(presented);
+	presentedValid = false;
+
+	screen.pixels = (uint16*)calloc(pitch * lines, sizeof(uint16));
+	screen.pixels8 = (uint8*)calloc(pitch * lines, 1);
+	presented = (uint32*)malloc(width * height * sizeof(uint32));
+	screen.pitch = pitch;
+	screen.width = width;
+	screen.height = height;
+
+	return screen.pixels != NULL && screen.pixels8 != NULL && presented != NULL;
+}
+
+void platform_video_present(bool rendered)
+{
+	// a frame not rendered shows the previous one again
+	if (rendered || !presentedValid) {
+		PROFILE_BEGIN(PROFILE_PRESENT);
+		host_frame_rgb(presented);
+		PROFILE_END(PROFILE_PRESENT);
+		presentedValid = true;
+	}
+}
+
+const uint32 *host_presented_frame()
+{
+	return presentedValid ? presented : NULL;
+}
+
+void host_frame_rgb(uint32 *dst)
+{
+	// 3DO RGB555 colors, or indexed through the row palettes
+	int x, y;
+
+	for (y=0; y<screen.height; ++y) {
+		const int offset = y * screen.pitch + (scrollRowX[y >> 3] & 7);
+		const uint16 *palette = row_palette[y >> 3];
+
+		for (x=0; x<screen.width; ++x) {
+			const int c = (outputMode == OUTPUT_INDEXED_8BPP) ? palette[screen.pixels8[offset + x] & 31] : screen.pixels[offset + x];
+
+			*dst++ = (((c >> 10) & 31) << 19) | (((c >> 5) & 31) << 11) | ((c & 31) << 3);
+		}
+	}
+}
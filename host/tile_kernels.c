@@ -0,0 +1,311 @@
+/*
+ * tile_kernels.c - scalar, SSSE3, AVX2 and NEON pixel expansion kernels
+ *
+ * x86 variants are compiled with target attributes and picked at runtime from the CPU features,
+ * NEON is always there on AArch64. Output is little endian 16bit pixels.
+ */
+
+#include "ppu.h"
+#include "tile_kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TILE_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define TILE_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+
+static void bg_row_scalar(unsigned short *dst, const unsigned char *plane0, const unsigned char *plane1,
+	const unsigned char *attr, int tiles, const unsigned short *pal)
+{
+	int t, b;
+
+	for (t=0; t<tiles; ++t) {
+		const unsigned int p0 = plane0[t];
+		const unsigned int p1 = plane1[t];
+		const unsigned int a = attr[t] << 2;
+
+		for (b=0; b<8; ++b) {
+			const unsigned int c = ((p0 >> (7 - b)) & 1) | (((p1 >> (7 - b)) & 1) << 1);
+			*dst++ = pal[a | c];
+		}
+	}
+}
+
+static void sprite_row_scalar(unsigned short *dst, const unsigned char *spr, int count, const unsigned short *spr_pal)
+{
+	int i;
+
+	for (i=0; i<count; ++i) {
+		const unsigned int s = spr[i];
+
+		if ((s & 3) && (!(s & SPRITE_PIXEL_BEHIND) || !(dst[i] & BG_PIXEL_OPAQUE))) {
+			dst[i] = spr_pal[s & 15];
+		}
+	}
+}
+
+static const tile_kernels kernels_scalar = { "scalar", bg_row_scalar, sprite_row_scalar };
+
+
+#if TILE_KERNELS_X86
+
+__attribute__((target("ssse3")))
+static __m128i broadcast_tile_pair_ssse3(const unsigned char *src)
+{
+	// lanes 0-7 get src[0], lanes 8-15 src[1]
+	const __m128i pair = _mm_cvtsi32_si128(src[0] | (src[1] << 8));
+	return _mm_shuffle_epi8(pair, _mm_set_epi8(1,1,1,1,1,1,1,1, 0,0,0,0,0,0,0,0));
+}
+
+__attribute__((target("ssse3")))
+static __m128i tile_pair_indices_ssse3(const unsigned char *plane0, const unsigned char *plane1, const unsigned char *attr)
+{
+	// pixel bits MSB first, merged with the attribute into 4bit palette indices
+	const __m128i bits = _mm_set_epi8(1,2,4,8,16,32,64,-128, 1,2,4,8,16,32,64,-128);
+	const __m128i p0 = broadcast_tile_pair_ssse3(plane0);
+	const __m128i p1 = broadcast_tile_pair_ssse3(plane1);
+	const __m128i a = broadcast_tile_pair_ssse3(attr);
+	const __m128i c0 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(p0, bits), bits), _mm_set1_epi8(1));
+	const __m128i c1 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(p1, bits), bits), _mm_set1_epi8(2));
+
+	return _mm_or_si128(_mm_or_si128(c0, c1), _mm_slli_epi16(a, 2));
+}
+
+__attribute__((target("ssse3")))
+static void bg_row_ssse3(unsigned short *dst, const unsigned char *plane0, const unsigned char *plane1,
+	const unsigned char *attr, int tiles, const unsigned short *pal)
+{
+	// the 16 colors split in low and high byte tables, looked up 16 pixels at a time with pshufb
+	const __m128i pal0 = _mm_loadu_si128((const __m128i*)pal);
+	const __m128i pal1 = _mm_loadu_si128((const __m128i*)(pal + 8));
+	const __m128i lo_bytes = _mm_set_epi8(-1,-1,-1,-1,-1,-1,-1,-1, 14,12,10,8,6,4,2,0);
+	const __m128i hi_bytes = _mm_set_epi8(-1,-1,-1,-1,-1,-1,-1,-1, 15,13,11,9,7,5,3,1);
+	const __m128i pal_lo = _mm_unpacklo_epi64(_mm_shuffle_epi8(pal0, lo_bytes), _mm_shuffle_epi8(pal1, lo_bytes));
+	const __m128i pal_hi = _mm_unpacklo_epi64(_mm_shuffle_epi8(pal0, hi_bytes), _mm_shuffle_epi8(pal1, hi_bytes));
+	int t;
+
+	for (t=0; t+2<=tiles; t+=2) {
+		const __m128i idx = tile_pair_indices_ssse3(plane0 + t, plane1 + t, attr + t);
+		const __m128i lo = _mm_shuffle_epi8(pal_lo, idx);
+		const __m128i hi = _mm_shuffle_epi8(pal_hi, idx);
+
+		_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi8(lo, hi));
+		_mm_storeu_si128((__m128i*)(dst + 8), _mm_unpackhi_epi8(lo, hi));
+		dst += 16;
+	}
+
+	if (t < tiles) bg_row_scalar(dst, plane0 + t, plane1 + t, attr + t, tiles - t, pal);
+}
+
+__attribute__((target("ssse3")))
+static void sprite_row_ssse3(unsigned short *dst, const unsigned char *spr, int count, const unsigned short *spr_pal)
+{
+	const __m128i pal0 = _mm_loadu_si128((const __m128i*)spr_pal);
+	const __m128i pal1 = _mm_loadu_si128((const __m128i*)(spr_pal + 8));
+	const __m128i lo_bytes = _mm_set_epi8(-1,-1,-1,-1,-1,-1,-1,-1, 14,12,10,8,6,4,2,0);
+	const __m128i hi_bytes = _mm_set_epi8(-1,-1,-1,-1,-1,-1,-1,-1, 15,13,11,9,7,5,3,1);
+	const __m128i pal_lo = _mm_unpacklo_epi64(_mm_shuffle_epi8(pal0, lo_bytes), _mm_shuffle_epi8(pal1, lo_bytes));
+	const __m128i pal_hi = _mm_unpacklo_epi64(_mm_shuffle_epi8(pal0, hi_bytes), _mm_shuffle_epi8(pal1, hi_bytes));
+	const __m128i zero = _mm_setzero_si128();
+	int i;
+
+	for (i=0; i+8<=count; i+=8) {
+		const __m128i s = _mm_loadl_epi64((const __m128i*)(spr + i));
+		const __m128i bg = _mm_loadu_si128((const __m128i*)(dst + i));
+
+		// byte masks widened to 16 bits by duplicating each byte
+		const __m128i transparent = _mm_cmpeq_epi8(_mm_and_si128(s, _mm_set1_epi8(3)), zero);
+		const __m128i behind = _mm_cmpeq_epi8(_mm_and_si128(s, _mm_set1_epi8(SPRITE_PIXEL_BEHIND)), _mm_set1_epi8(SPRITE_PIXEL_BEHIND));
+		const __m128i transparent16 = _mm_unpacklo_epi8(transparent, transparent);
+		const __m128i behind16 = _mm_unpacklo_epi8(behind, behind);
+		const __m128i bg_opaque16 = _mm_srai_epi16(bg, 15);
+		const __m128i keep = _mm_or_si128(transparent16, _mm_and_si128(behind16, bg_opaque16));
+
+		const __m128i idx = _mm_and_si128(s, _mm_set1_epi8(15));
+		const __m128i color = _mm_unpacklo_epi8(_mm_shuffle_epi8(pal_lo, idx), _mm_shuffle_epi8(pal_hi, idx));
+
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(keep, bg), _mm_andnot_si128(keep, color)));
+	}
+
+	if (i < count) sprite_row_scalar(dst + i, spr + i, count - i, spr_pal);
+}
+
+static const tile_kernels kernels_ssse3 = { "ssse3", bg_row_ssse3, sprite_row_ssse3 };
+
+
+__attribute__((target("avx2")))
+static __m256i tile_quad_indices_avx2(const unsigned char *plane0, const unsigned char *plane1, const unsigned char *attr)
+{
+	// four tiles at once, each 128bit lane spreads two of them like the SSSE3 version
+	const __m256i spread = _mm256_set_epi8(3,3,3,3,3,3,3,3, 2,2,2,2,2,2,2,2, 1,1,1,1,1,1,1,1, 0,0,0,0,0,0,0,0);
+	const __m256i bits = _mm256_set_epi8(1,2,4,8,16,32,64,-128, 1,2,4,8,16,32,64,-128, 1,2,4,8,16,32,64,-128, 1,2,4,8,16,32,64,-128);
+	const __m256i p0 = _mm256_shuffle_epi8(_mm256_set1_epi32(plane0[0] | (plane0[1] << 8) | (plane0[2] << 16) | (plane0[3] << 24)), spread);
+	const __m256i p1 = _mm256_shuffle_epi8(_mm256_set1_epi32(plane1[0] | (plane1[1] << 8) | (plane1[2] << 16) | (plane1[3] << 24)), spread);
+	const __m256i a = _mm256_shuffle_epi8(_mm256_set1_epi32(attr[0] | (attr[1] << 8) | (attr[2] << 16) | (attr[3] << 24)), spread);
+	const __m256i c0 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(p0, bits), bits), _mm256_set1_epi8(1));
+	const __m256i c1 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(p1, bits), bits), _mm256_set1_epi8(2));
+
+	return _mm256_or_si256(_mm256_or_si256(c0, c1), _mm256_slli_epi16(a, 2));
+}
+
+__attribute__((target("avx2")))
+static void bg_row_avx2(unsigned short *dst, const unsigned char *plane0, const unsigned char *plane1,
+	const unsigned char *attr, int tiles, const unsigned short *pal)
+{
+	// four tiles per step, pshufb works per 128bit lane so the tables are in both lanes
+	const __m128i pal0 = _mm_loadu_si128((const __m128i*)pal);
+	const __m128i pal1 = _mm_loadu_si128((const __m128i*)(pal + 8));
+	const __m128i lo_bytes = _mm_set_epi8(-1,-1,-1,-1,-1,-1,-1,-1, 14,12,10,8,6,4,2,0);
+	const __m128i hi_bytes = _mm_set_epi8(-1,-1,-1,-1,-1,-1,-1,-1, 15,13,11,9,7,5,3,1);
+	const __m256i pal_lo = _mm256_broadcastsi128_si256(_mm_unpacklo_epi64(_mm_shuffle_epi8(pal0, lo_bytes), _mm_shuffle_epi8(pal1, lo_bytes)));
+	const __m256i pal_hi = _mm256_broadcastsi128_si256(_mm_unpacklo_epi64(_mm_shuffle_epi8(pal0, hi_bytes), _mm_shuffle_epi8(pal1, hi_bytes)));
+	int t;
+
+	for (t=0; t+4<=tiles; t+=4) {
+		const __m256i idx = tile_quad_indices_avx2(plane0 + t, plane1 + t, attr + t);
+		const __m256i lo = _mm256_shuffle_epi8(pal_lo, idx);
+		const __m256i hi = _mm256_shuffle_epi8(pal_hi, idx);
+		// lane 0 holds tiles t and t+1, lane 1 tiles t+2 and t+3
+		const __m256i even = _mm256_unpacklo_epi8(lo, hi);
+		const __m256i odd = _mm256_unpackhi_epi8(lo, hi);
+
+		_mm256_storeu_si256((__m256i*)dst, _mm256_permute2x128_si256(even, odd, 0x20));
+		_mm256_storeu_si256((__m256i*)(dst + 16), _mm256_permute2x128_si256(even, odd, 0x31));
+		dst += 32;
+	}
+
+	if (t < tiles) bg_row_scalar(dst, plane0 + t, plane1 + t, attr + t, tiles - t, pal);
+}
+
+__attribute__((target("avx2")))
+static void sprite_row_avx2(unsigned short *dst, const unsigned char *spr, int count, const unsigned short *spr_pal)
+{
+	const __m128i pal0 = _mm_loadu_si128((const __m128i*)spr_pal);
+	const __m128i pal1 = _mm_loadu_si128((const __m128i*)(spr_pal + 8));
+	const __m128i lo_bytes = _mm_set_epi8(-1,-1,-1,-1,-1,-1,-1,-1, 14,12,10,8,6,4,2,0);
+	const __m128i hi_bytes = _mm_set_epi8(-1,-1,-1,-1,-1,-1,-1,-1, 15,13,11,9,7,5,3,1);
+	const __m128i pal_lo = _mm_unpacklo_epi64(_mm_shuffle_epi8(pal0, lo_bytes), _mm_shuffle_epi8(pal1, lo_bytes));
+	const __m128i pal_hi = _mm_unpacklo_epi64(_mm_shuffle_epi8(pal0, hi_bytes), _mm_shuffle_epi8(pal1, hi_bytes));
+	const __m128i zero = _mm_setzero_si128();
+	int i;
+
+	for (i=0; i+16<=count; i+=16) {
+		const __m128i s = _mm_loadu_si128((const __m128i*)(spr + i));
+		const __m256i bg = _mm256_loadu_si256((const __m256i*)(dst + i));
+
+		const __m128i transparent = _mm_cmpeq_epi8(_mm_and_si128(s, _mm_set1_epi8(3)), zero);
+		const __m128i behind = _mm_cmpeq_epi8(_mm_and_si128(s, _mm_set1_epi8(SPRITE_PIXEL_BEHIND)), _mm_set1_epi8(SPRITE_PIXEL_BEHIND));
+		const __m256i keep = _mm256_or_si256(_mm256_cvtepi8_epi16(transparent),
+			_mm256_and_si256(_mm256_cvtepi8_epi16(behind), _mm256_srai_epi16(bg, 15)));
+
+		const __m128i idx = _mm_and_si128(s, _mm_set1_epi8(15));
+		const __m256i color = _mm256_or_si256(_mm256_cvtepu8_epi16(_mm_shuffle_epi8(pal_lo, idx)),
+			_mm256_slli_epi16(_mm256_cvtepu8_epi16(_mm_shuffle_epi8(pal_hi, idx)), 8));
+
+		// and/andnot rather than blendv, GCC folds that to a char compare -funsigned-char makes never true
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(_mm256_and_si256(keep, bg), _mm256_andnot_si256(keep, color)));
+	}
+
+	if (i < count) sprite_row_scalar(dst + i, spr + i, count - i, spr_pal);
+}
+
+static const tile_kernels kernels_avx2 = { "avx2", bg_row_avx2, sprite_row_avx2 };
+
+#endif
+
+
+#if TILE_KERNELS_NEON
+
+static uint8x16_t tile_pair_indices_neon(const unsigned char *plane0, const unsigned char *plane1, const unsigned char *attr)
+{
+	static const unsigned char bit_table[16] = { 128,64,32,16,8,4,2,1, 128,64,32,16,8,4,2,1 };
+	const uint8x16_t bits = vld1q_u8(bit_table);
+	const uint8x16_t p0 = vcombine_u8(vdup_n_u8(plane0[0]), vdup_n_u8(plane0[1]));
+	const uint8x16_t p1 = vcombine_u8(vdup_n_u8(plane1[0]), vdup_n_u8(plane1[1]));
+	const uint8x16_t a = vcombine_u8(vdup_n_u8(attr[0] << 2), vdup_n_u8(attr[1] << 2));
+	const uint8x16_t c0 = vandq_u8(vtstq_u8(p0, bits), vdupq_n_u8(1));
+	const uint8x16_t c1 = vandq_u8(vtstq_u8(p1, bits), vdupq_n_u8(2));
+
+	return vorrq_u8(vorrq_u8(c0, c1), a);
+}
+
+static void bg_row_neon(unsigned short *dst, const unsigned char *plane0, const unsigned char *plane1,
+	const unsigned char *attr, int tiles, const unsigned short *pal)
+{
+	// deinterleaving the palette gives the low and high byte tables for tbl
+	const uint8x16x2_t pal_bytes = vld2q_u8((const unsigned char*)pal);
+	int t;
+
+	for (t=0; t+2<=tiles; t+=2) {
+		const uint8x16_t idx = tile_pair_indices_neon(plane0 + t, plane1 + t, attr + t);
+		const uint8x16_t lo = vqtbl1q_u8(pal_bytes.val[0], idx);
+		const uint8x16_t hi = vqtbl1q_u8(pal_bytes.val[1], idx);
+
+		vst1q_u8((unsigned char*)dst, vzip1q_u8(lo, hi));
+		vst1q_u8((unsigned char*)(dst + 8), vzip2q_u8(lo, hi));
+		dst += 16;
+	}
+
+	if (t < tiles) bg_row_scalar(dst, plane0 + t, plane1 + t, attr + t, tiles - t, pal);
+}
+
+static void sprite_row_neon(unsigned short *dst, const unsigned char *spr, int count, const unsigned short *spr_pal)
+{
+	const uint8x16x2_t pal_bytes = vld2q_u8((const unsigned char*)spr_pal);
+	int i;
+
+	for (i=0; i+8<=count; i+=8) {
+		const uint8x8_t s = vld1_u8(spr + i);
+		const uint16x8_t bg = vld1q_u16(dst + i);
+
+		const uint16x8_t opaque16 = vreinterpretq_u16_s16(vmovl_s8(vreinterpret_s8_u8(vtst_u8(s, vdup_n_u8(3)))));
+		const uint16x8_t behind16 = vreinterpretq_u16_s16(vmovl_s8(vreinterpret_s8_u8(vtst_u8(s, vdup_n_u8(SPRITE_PIXEL_BEHIND)))));
+		const uint16x8_t bg_opaque16 = vreinterpretq_u16_s16(vshrq_n_s16(vreinterpretq_s16_u16(bg), 15));
+		const uint16x8_t draw = vbicq_u16(opaque16, vandq_u16(behind16, bg_opaque16));
+
+		const uint8x8_t idx = vand_u8(s, vdup_n_u8(15));
+		const uint16x8_t color = vorrq_u16(vmovl_u8(vqtbl1_u8(pal_bytes.val[0], idx)), vshll_n_u8(vqtbl1_u8(pal_bytes.val[1], idx), 8));
+
+		vst1q_u16(dst + i, vbslq_u16(draw, color, bg));
+	}
+
+	if (i < count) sprite_row_scalar(dst + i, spr + i, count - i, spr_pal);
+}
+
+static const tile_kernels kernels_neon = { "neon", bg_row_neon, sprite_row_neon };
+
+#endif
+
+
+int tile_kernels_available(const tile_kernels **list, int max)
+{
+	int n = 0;
+
+	if (n < max) list[n++] = &kernels_scalar;
+
+#if TILE_KERNELS_X86
+	__builtin_cpu_init();
+	if (n < max && __builtin_cpu_supports("ssse3")) list[n++] = &kernels_ssse3;
+	if (n < max && __builtin_cpu_supports("avx2")) list[n++] = &kernels_avx2;
+#endif
+
+#if TILE_KERNELS_NEON
+	if (n < max) list[n++] = &kernels_neon;
+#endif
+
+	return n;
+}
+
+const tile_kernels *tile_kernels_select(void)
+{
+	// the list is in order of preference
+	const tile_kernels *list[4];
+	const int n = tile_kernels_available(list, 4);
+
+	return list[n - 1];
+}
@@ -0,0 +1,38 @@
+/*
+ * tile_kernels.h - pixel expansion kernels for host builds
+ *
+ * The 3DO renderer expands tiles with the tilemix/palmap32 tables, which suits the ARM60.
+ * Hosts with SIMD do the same work a few tiles at a time with byte shuffles. Host builds of the
+ * core (TILE_KERNELS) draw through the selected variant, "nesbench -c" checks every variant
+ * against the tilemix/palmap32 renderer on a game's frames.
+ */
+
+#ifndef TILE_KERNELS_H
+#define TILE_KERNELS_H
+
+// Sprite line pixels, one byte each: 0 where there's no sprite, else 0x10 | (attribute << 2) | color
+// (so the low 5 bits are the palette index) and ppu.h's SPRITE_PIXEL_BEHIND if it has background priority.
+// Direct color background pixels have this bit set when opaque, as palmap32 sets it.
+#define BG_PIXEL_OPAQUE 0x8000
+
+// Expands tiles * 8 background pixels from the two pattern planes and the attribute (0-3) of each tile.
+// pal has 16 colors indexed by (attribute << 2) | color, entries 0, 4, 8 and 12 must all hold the backdrop.
+typedef void (*bg_row_kernel)(unsigned short *dst, const unsigned char *plane0, const unsigned char *plane1,
+	const unsigned char *attr, int tiles, const unsigned short *pal);
+
+// Draws a sprite line over count background pixels, colors indexed by the low 4 bits of the sprite pixels.
+typedef void (*sprite_row_kernel)(unsigned short *dst, const unsigned char *spr, int count, const unsigned short *spr_pal);
+
+typedef struct {
+	const char *name;
+	bg_row_kernel bg_row;
+	sprite_row_kernel sprite_row;
+} tile_kernels;
+
+// all variants built in and supported by this CPU, the scalar reference first
+int tile_kernels_available(const tile_kernels **list, int max);
+
+// the fastest of them
+const tile_kernels *tile_kernels_select(void);
+
+#endif
@@ -0,0 +1,22 @@
+/*
+ * types.h - the 3DO SDK integer types, for host builds of the core
+ */
+
+#ifndef LAMENES_HOST_TYPES_H
+#define LAMENES_HOST_TYPES_H
+
+typedef unsigned char uint8;
+typedef signed char int8;
+typedef unsigned short uint16;
+typedef short int16;
+typedef unsigned int uint32;
+typedef int int32;
+typedef unsigned char ubyte;
+typedef unsigned char uchar;
+
+// one byte like the SDK's, snapshot structs hold them
+typedef unsigned char bool;
+#define true 1
+#define false 0
+
+#endif
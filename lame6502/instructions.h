@@ -60,6 +60,10 @@ void SET_SR(unsigned char b);
  * instructions.h - 6502 cpu instruction macros
  */
 
+/* the IRQ line is level triggered, an instruction clearing the I flag lets a pending IRQ in right away */
+#define TAKE_PENDING_IRQ()	{ if(irq_line && !interrupt_flag) \
+					cycle_count = IRQ(cycle_count); }
+
 #define ADC_IM(CYCLES)		{ val = memory[program_counter]; \
 					res = accumulator + val + carry_flag; \
 					overflow_flag = (~(accumulator ^ val)) & (accumulator ^ res) & 0x80; \
@@ -345,7 +349,8 @@ void SET_SR(unsigned char b);
 					cycle_count -= CYCLES; break; }
 
 #define CLEAR_ID(CYCLES)	{ interrupt_flag = 0; \
-					cycle_count -= CYCLES; break; }
+					cycle_count -= CYCLES; \
+					TAKE_PENDING_IRQ(); break; }
 
 #define CLEAR_OF(CYCLES)	{ overflow_flag = 0; \
 					cycle_count -= CYCLES; break; }
@@ -807,6 +812,7 @@ void SET_SR(unsigned char b);
 					addr = memory_read(stack_pointer+0x100); \
 					SET_SR(addr); \
 					cycle_count -= CYCLES; \
+					TAKE_PENDING_IRQ(); \
 					break; }
 
 #define ROTATE_LEFT_ACC(CYCLES)		{ tmp = carry_flag; \
@@ -938,6 +944,7 @@ void SET_SR(unsigned char b);
 					PULL_ST(); \
 					program_counter += (addr << 8); \
 					cycle_count -= CYCLES; \
+					TAKE_PENDING_IRQ(); \
 					break; }
 
 #define RET_SUB(CYCLES)		{ PULL_ST(); \
@@ -98,6 +98,8 @@ int carry_flag;		/* this holds the "carry" out of the most significant bit of th
 
 int cycle_count;
 
+int irq_line = 0;	/* one bit per device pulling the IRQ line low, it stays low until the device is acknowledged */
+
 
 /*void update_status_register()
 {
@@ -161,6 +163,7 @@ int CPU_execute(int cycles)
 	unsigned char opcode;
 
 	cycle_count = cycles;
+	TAKE_PENDING_IRQ();
 	do 
 	{
 		//update_status_register();
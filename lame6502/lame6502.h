@@ -55,6 +55,10 @@ extern int decimal_flag;
 extern int interrupt_flag;
 extern int carry_flag;
 
+extern int cycle_count;
+
+extern int irq_line;
+
 extern int hit_break;
 
 extern int breakpoint;
@@ -44,15 +44,12 @@
 #include "palette.h"
 #include "nes_input.h"
 #include "memory.h"
-
-#include "3DO/core.h"
-#include "3DO/input.h"
-#include "3DO/system_graphics.h"
-#include "3DO/tools.h"
-
-#define MAX_FILES_NUM 1024
-#define MAX_FILENAME_LENGTH 256
-
+#include "scheduler.h"
+#include "rewind.h"
+#include "profiler.h"
+#include "state.h"
+#include "movie.h"
+#include "platform.h"
 
 char romfn[256];
 
@@ -66,465 +63,423 @@ unsigned int scanline_refresh;
 
 int systemType;
 
-bool pause_emulation = false;
-
 unsigned short NES_screen_width;
 unsigned short NES_screen_height;
 
-CCB *screenCel;
-CCB *screenRowCel[32];
+ScreenSurface screen;
+
+// colors of each 8bpp row, palette RAM as it was when the row started
+uint16 row_palette[32][32];
+bool row_palette_changed[32];
+static unsigned int rowPaletteVersion[32];
+// next presentation draws every row, not only the changed ones
+bool present_all_rows = true;
 int scrollRowX[32];
-uint16 palette3DO[256];
+// one bank per $2001 color emphasis (R, G, B) and monochrome combination, palette3DO points to the selected one
+uint16 palette3DObanks[PALETTE_BANKS_NUM][256];
+uint16 *palette3DO = palette3DObanks[0];
 
 long romlen;
 
-int frameskipNum = 0;
-bool skipRendering = false;
 bool skipCPU = false;
 
+// frames emulated ahead of the one played, to hide the game's input lag
+int runAheadFrames = RUN_AHEAD_FRAMES;
+static void *runAheadState = NULL;
+uint32 run_ahead_us = 0;
+
+// the state right after load_game, a power cycle goes back to it
+static void *powerOnState = NULL;
+
 int renderer = RENDERER_PER_TILE;
+int outputMode = OUTPUT_DIRECT_16BPP;
 
+// master clock at the end of vblank this frame, -1 outside the visible part
+static master_clock_t visibleStart = -1;
+static int lineMasterCycles = 0;
 
-static void initNESscreenCELs()
-{
-	int y;
-	const uint32 width = NES_screen_width + 8;
-	const uint32 height = NES_screen_height + 8;
-
-	screenCel = CreateCel(width, height, 16, CREATECEL_UNCODED, NULL);
-	screenCel->ccb_Flags |= (CCB_LAST | CCB_BGND);
-	screenCel->ccb_XPos = 32 << 16;
-
-	for (y=0; y<32; ++y) {
-		screenRowCel[y] = CreateCel(width, 8, 16, CREATECEL_UNCODED, (uint16*)screenCel->ccb_SourcePtr + y * width * 8);
-		screenRowCel[y]->ccb_XPos = screenCel->ccb_XPos;
-		screenRowCel[y]->ccb_YPos = (y * 8) << 16;
-		screenRowCel[y]->ccb_Flags = screenCel->ccb_Flags & ~CCB_LAST;
-		if (y!=0) LinkCel(screenRowCel[y-1], screenRowCel[y]);
-	}
-	screenRowCel[31]->ccb_Flags |= CCB_LAST;
-}
+// APU frame counter, in 4 step mode the frame IRQ is raised every 29830 CPU cycles (33254 on PAL)
+#define APU_FRAME_IRQ_PERIOD_NTSC 29830
+#define APU_FRAME_IRQ_PERIOD_PAL 33254
 
-static void initNESpal3DO()
+// next line (a multiple of renderLineStep) not rendered yet this frame, -1 outside the visible part
+static int nextRenderLine = -1;
+static int renderLineStep = 1;
+static bool renderThisFrame = false;
+
+
+static void updateRowPalette(int charLine)
 {
+	// background index 0 of every sub-palette (and the unused sprite one) shows the backdrop
+	uint16 *colors = row_palette[charLine];
 	int i;
-	for (i=0; i<256; ++i) {
-		palette3DO[i] = MAKE_NES_TO_3DO_PAL(palette[i & 63].r, palette[i & 63].g, palette[i & 63].b);
-	}
-}
 
-static void updateSmoothScrollingRow(int charLine)
-{
-	const uint32 scrollX = scrollRowX[charLine] & 7;
-	CCB *rowCel = screenRowCel[charLine];
+	if (rowPaletteVersion[charLine] == palette_version && !present_all_rows) return;
+	rowPaletteVersion[charLine] = palette_version;
+	row_palette_changed[charLine] = true;
 
-	rowCel->ccb_PRE0 = (rowCel->ccb_PRE0 & ~(255U << 24)) | (scrollX << 24);
-	rowCel->ccb_PRE1 = (rowCel->ccb_PRE1 & ~PRE1_TLHPCNT_MASK) | (NES_screen_width + scrollX - 1);
+	for (i=0; i<32; ++i) {
+		colors[i] = palette3DO[ppu_memory[0x3f00 + ((i & 3) ? i : 0)]];
+	}
 }
 
-static void updateSmoothScrolling()
+static void initNESpal3DO()
 {
-	int y;
-	for (y=0; y<32; ++y) {
-		updateSmoothScrollingRow(y);
+	int i, bank;
+	for (bank=0; bank<PALETTE_BANKS_NUM; ++bank) {
+		const int emphasis = bank >> 1;
+
+		for (i=0; i<256; ++i) {
+			// monochrome keeps only the luminance column of the NES palette
+			const int c = (bank & 1) ? (i & 0x30) : (i & 63);
+			int r = palette[c].r;
+			int g = palette[c].g;
+			int b = palette[c].b;
+
+			// emphasis darkens the channels that are not emphasized
+			if (emphasis != 0) {
+				if (!(emphasis & EMPHASIS_RED)) r = (r * 3) >> 2;
+				if (!(emphasis & EMPHASIS_GREEN)) g = (g * 3) >> 2;
+				if (!(emphasis & EMPHASIS_BLUE)) b = (b * 3) >> 2;
+			}
+			palette3DObanks[bank][i] = MAKE_NES_TO_3DO_PAL(r, g, b);
+		}
 	}
+	palette3DO = palette3DObanks[0];
 }
 
-static void drawNESscreenCELs()
+int current_scanline()
 {
-	drawCels(screenRowCel[0]);
+	if (visibleStart < 0) return -1;
+	// the visible part is short enough for a 32 bit division
+	return (int)(cpu_master_clock() - visibleStart) / lineMasterCycles;
 }
 
-static void runEmulationFrame()
+void reschedule_mapper_irq()
 {
-	static int frame = 0;
-
-	unsigned short counter = 0;
-	unsigned short scanline = 0;
-
-	bool skipThisFrame = frame || skipRendering;
+	// the MMC3 IRQ fires at the end of the line the counter points to, if that's still ahead this frame
+	master_clock_t when;
 
-	uint32 lineStep = 1;
-	if (renderer!=RENDERER_PER_LINE) {
-		lineStep = 8;
+	if (visibleStart < 0 || mmc3_irq_enable != 1 || mmc3_irq_counter < 0 || mmc3_irq_counter >= NES_screen_height) {
+		cancel_event(EVENT_MAPPER_IRQ);
+		return;
 	}
 
-	if (!skipCPU) {
-		CPU_execute(start_int);
-
-		// set ppu_status D7 to 1 and enter vblank
-		ppu_status |= 0x80;
-		write_memory(0x2002,ppu_status);
-
-		counter += CPU_execute(12); // needed for some roms
-
-		if(exec_nmi_on_vblank) {
-			counter += NMI(counter);
-		}
-
-		counter += CPU_execute(vblank_cycle_timeout);
-
-		// vblank ends (ppu_status D7) is set to 0, sprite_zero (ppu_status D6) is set to 0
-		ppu_status &= 0x3F;
-
-		// and write to mem
-		write_memory(0x2002,ppu_status);
-
-		loopyV = loopyT;
+	when = visibleStart + (mmc3_irq_counter + 1) * lineMasterCycles;
+	if (when > cpu_master_clock()) {
+		schedule_event(EVENT_MAPPER_IRQ, when);
+	} else {
+		cancel_event(EVENT_MAPPER_IRQ);
 	}
+}
 
-	updateNesInput();
-	
-	for(scanline = 0; scanline < NES_screen_height; scanline+=lineStep) {
-		if(!sprite_zero) {
-			int i;
-			for (i=0; i<lineStep; ++i) {
-				const uint32 y = scanline + i;
-				if (y > 0) check_sprite_hit(y);
-			}
-		}
-		
-		if (!skipThisFrame) {
-			if ((scanline & 7) == 0) {
-				scrollRowX[scanline >> 3] = loopyX & 7;
-			}
-
-			if (scanline == 0) updatePalmap32();
-			//if ((scanline & 7) == 0) updatePalmap32();
-			//if ((scanline & 15) == 0) updatePalmap32();
-
-			update_scanline_values(scanline, lineStep);
-
-			// We may not need the second check. Either a lame hack to position screen or it actually does have to do with different NES timings
-			if (background_on && !(systemType == SYSTEM_NTSC && scanline < 8)) {
-				render_background(scanline);
-			}
-		}
+static int apuFrameIrqPeriod()
+{
+	return (systemType == SYSTEM_PAL) ? APU_FRAME_IRQ_PERIOD_PAL : APU_FRAME_IRQ_PERIOD_NTSC;
+}
 
-		if (!skipCPU) {
-			counter += CPU_execute(lineStep*scanline_refresh);
-
-			if(mmc3_irq_enable == 1) {
-				int i;
-				bool mmc3_has_irq = false;
-				for (i=0; i<lineStep; ++i) {
-					if(scanline + i == mmc3_irq_counter) {
-						mmc3_has_irq = true;
-						break;
-					}
-				}
-				if(mmc3_has_irq) {
-					IRQ(counter);
-					mmc3_irq_counter--;
-				}
-			}
-		}
+void apu_frame_counter_write(unsigned char data)
+{
+	// D6 inhibits the frame IRQ and acknowledges it, 5 step mode (D7) never raises it, either way the sequence restarts
+	if (data & 0x40) {
+		irq_line &= ~IRQ_SOURCE_APU_FRAME;
 	}
 
-	if (!skipThisFrame) {
-		render_sprites();
-		updateSmoothScrolling();
+	if (data & 0xC0) {
+		cancel_event(EVENT_APU_FRAME_IRQ);
+	} else {
+		schedule_event(EVENT_APU_FRAME_IRQ, cpu_master_clock() + apuFrameIrqPeriod() * master_cycles_per_cpu_cycle);
 	}
-
-	// Draw Screen
-	drawNESscreenCELs();
-
-	/*if(!interrupt_flag) {
-		counter += IRQ(counter);
-	}*/
-
-	frame = (frame + 1) % (frameskipNum + 1);
 }
 
-/*static void reset_emulation()
+unsigned char apu_status_read()
 {
-	if(load_rom(romfn) == 1) {
-		free(sprite_memory);
-		free(ppu_memory);
-		free(memory);
-		free(romcache);
-		exit(1);
-	}
-
-	if(MAPPER == 4)
-		mmc3_reset();
-
-	CPU_reset();
-
-	resetNesInput();
+	// D6 is the frame interrupt flag, reading acknowledges it
+	const unsigned char status = (irq_line & IRQ_SOURCE_APU_FRAME) ? 0x40 : 0;
 
-	runEmulationFrame();
-}*/
+	irq_line &= ~IRQ_SOURCE_APU_FRAME;
 
+	return status;
+}
 
-void runEmu()
+static void renderLines(int scanline)
 {
-	int i;
-
-	if (DEBUG_MEM_FREQS) {
-		mr_nohw = 0;
-		mr_hw = 0;
-		mr_0x2002 = 0;
-		mr_0x2007 = 0;
-		mr_0x4016 = 0;
-		mw_other = 0;
-		mw_ppu = 0;
-		mw_0x2002 = 0;
-		mw_0x4014 = 0;
-		mw_0x4016 = 0;
-		mw_mirror_low = 0;
-
-		mw_ppu_0x2000 = 0;
-		mw_ppu_0x2001 = 0;
-		mw_ppu_0x2003 = 0;
-		mw_ppu_0x2004 = 0;
-		mw_ppu_0x2005 = 0;
-		mw_ppu_0x2006 = 0;
-		mw_ppu_0x2007 = 0;
-		mw_ppu_0x4014 = 0;
-	}
-	
-	// Frameskip to speed up things for testing
-	if (isJoyButtonPressedOnce(JOY_BUTTON_C)) {
-		frameskipNum = (frameskipNum + 1) & 3;
-		for (i=0; i<frameskipNum; ++i) {
-			int c = i + 1;
-			drawThickPixel(2*(i+1), 116, MakeRGB15(7 + (c << 3), 3 + (c << 2), c << 1));
-		}
-		for (i=frameskipNum; i<3; ++i) {
-			drawThickPixel(2*(i+1), 116, 0);
-		}
-	}
+	// so VRAM changes after this point are seen as new ones
+	ppu_end_vram_burst();
 
-	// No rendering emulation (to purely benchmark CPU)
-	skipRendering = isJoyButtonPressed(JOY_BUTTON_LPAD);
+	if (!renderThisFrame) return;
 
-	// Pause CPU execution (to benchmark rendering of the last frame only);
-	//skipCPU = isJoyButtonPressed(JOY_BUTTON_RPAD);
+	if ((scanline & 7) == 0) {
+		scrollRowX[scanline >> 3] = loopyX & 7;
 
-	// I will steal this button to toggle between the more accurate and the faster renderer
-	if (isJoyButtonPressedOnce(JOY_BUTTON_RPAD)) {
-		uint16 color = 0;
-		if (renderer == RENDERER_PER_LINE) {
-			color = MakeRGB15(7, 31, 15);
-			renderer = RENDERER_PER_TILE;
-		} else {
-			renderer = RENDERER_PER_LINE;
+		// indexed rows are colored when drawn, palette writes only cost a PLUT refresh
+		if (outputMode == OUTPUT_INDEXED_8BPP) {
+			updateRowPalette(scanline >> 3);
 		}
-		drawThickPixel(158, 2, color);
 	}
 
-	if (!pause_emulation) {
-		runEmulationFrame();
+	// rebuilds only the sub-palettes the CPU changed since the previous rendered line
+	if (outputMode == OUTPUT_DIRECT_16BPP) {
+		PROFILE_BEGIN(PROFILE_PALMAP);
+		updatePalmap32();
+		PROFILE_END(PROFILE_PALMAP);
 	}
 
-	if (DEBUG_MEM_FREQS) {
-		drawNumber(0, 8, mr_nohw);		// 1000
-		drawNumber(0, 16, mr_hw);		// 1000
-
-		drawNumber(0, 32, mr_0x2002);	// 1000
-		drawNumber(0, 40, mr_0x2007);	// 0
-		drawNumber(0, 48, mr_0x4016);	// 8
+	PROFILE_BEGIN(PROFILE_SCANLINE_VALUES);
+	update_scanline_values(scanline, renderLineStep);
+	PROFILE_END(PROFILE_SCANLINE_VALUES);
+
+	// lines drawn the same way last frame are already in the screen buffer
+	if (lines_need_render(scanline, renderLineStep)) {
+		// We may not need the second check. Either a lame hack to position screen or it actually does have to do with different NES timings
+		if (background_on && !(systemType == SYSTEM_NTSC && scanline < 8)) {
+			PROFILE_BEGIN(PROFILE_BACKGROUND);
+			render_background(scanline);
+			PROFILE_END(PROFILE_BACKGROUND);
+		}
+	}
+}
 
+static void renderLinesUntil(int line)
+{
+	if (nextRenderLine < 0) return;
 
-		drawNumber(0, 64, mw_other);	// 650
-		drawNumber(0, 72, mw_ppu);		// 12
+	while (nextRenderLine <= line && nextRenderLine < NES_screen_height) {
+		renderLines(nextRenderLine);
+		nextRenderLine += renderLineStep;
+	}
+}
 
-		drawNumber(0, 88, mw_0x2002);	// 2000
-		drawNumber(0, 96, mw_0x4014);	// 1
-		drawNumber(0, 104, mw_0x4016);	// 2
-		drawNumber(0, 112, mw_mirror_low);	// 650
+void catch_up_rendering()
+{
+	// Rendering is lazy, the CPU isn't stopped every line. Before it changes anything the PPU reads,
+	// every line (or 8 line row) that has started by now is rendered with the state it started with.
+	renderLinesUntil(current_scanline());
+}
 
-		drawNumber(0, 152, mw_ppu_0x2000);
-		drawNumber(0, 160, mw_ppu_0x2001);
-		drawNumber(0, 168, mw_ppu_0x2003);
-		drawNumber(0, 176, mw_ppu_0x2004);
-		drawNumber(0, 184, mw_ppu_0x2005);
-		drawNumber(0, 192, mw_ppu_0x2006);
-		drawNumber(0, 200, mw_ppu_0x2007);
-		drawNumber(0, 208, mw_ppu_0x4014);
-	}
+void invalidate_screen()
+{
+	invalidate_line_signatures();
+	present_all_rows = true;
 }
 
-int returnStringLength(char *str)
+static void resetFrameEvents()
 {
-	int i = 0;
-	while (i < MAX_FILENAME_LENGTH) {
-		if (*str++ == 0) return i;
-		++i;
-	}
-	return -1;
+	scheduler_reset((systemType == SYSTEM_PAL) ? MASTER_CYCLES_PER_CPU_CYCLE_PAL : MASTER_CYCLES_PER_CPU_CYCLE_NTSC);
+	lineMasterCycles = scanline_refresh * master_cycles_per_cpu_cycle;
+	visibleStart = -1;
+	nextRenderLine = -1;
+
+	// a frame starts with the post render line, the APU frame counter powers on in 4 step mode
+	schedule_event(EVENT_VBLANK_START, start_int * master_cycles_per_cpu_cycle);
+	schedule_event(EVENT_APU_FRAME_IRQ, apuFrameIrqPeriod() * master_cycles_per_cpu_cycle);
 }
 
-void showHelpScreen()
+static void startVisiblePart(master_clock_t when)
 {
-	const uint16 titleColor = MakeRGB15(31, 24, 15);
-	const uint16 textColor = MakeRGB15(24, 28, 31);
-	const uint16 specialColor = MakeRGB15(7, 31, 7);
-	const uint16 bluerColor = MakeRGB15(7, 15, 31);
-	const uint16 bugoColor = MakeRGB15(31, 15, 7);
+	evaluate_sprites();
+	predict_sprite0_hit();
 
-	while(!wasAnyJoyButtonPressed()) {
+	visibleStart = when;
+	nextRenderLine = 0;
 
-		updateInput();
+	if (sprite0_hit_line >= 0 && sprite0_hit_line < NES_screen_height) {
+		// 341 PPU dots per line
+		schedule_event(EVENT_SPRITE0_HIT, when + sprite0_hit_line * lineMasterCycles + ((sprite0_hit_x + 1) * lineMasterCycles) / 341);
+	}
+	if (sprite_overflow_line >= 0 && sprite_overflow_line < NES_screen_height) {
+		schedule_event(EVENT_SPRITE_OVERFLOW, when + sprite_overflow_line * lineMasterCycles);
+	}
+	reschedule_mapper_irq();
 
-		setTextColor(titleColor);
-		drawTextX2(32, 16, "Not So LameNES");
-		drawTextX2(32, 32, "--------------");
+	schedule_event(EVENT_RENDER_CHECKPOINT, when + NES_screen_height * lineMasterCycles);
+}
 
-		setTextColor(textColor);
-		drawText(8, 64, "Here are the instructions..");
+static bool runFrameEvent(int type, master_clock_t when)
+{
+	// returns true once the visible part of the frame is over
+	switch(type) {
+		case EVENT_VBLANK_START:
+			startNesInputFrame();
+
+			// set ppu_status D7 to 1 and enter vblank
+			ppu_status |= 0x80;
+			write_memory(0x2002,ppu_status);
+
+			// the NMI comes 12 cycles later, needed for some roms
+			schedule_event(EVENT_NMI, when + 12 * master_cycles_per_cpu_cycle);
+			schedule_event(EVENT_VBLANK_END, when + (12 + vblank_cycle_timeout) * master_cycles_per_cpu_cycle);
+		break;
+
+		case EVENT_NMI:
+			if (exec_nmi_on_vblank && !skipCPU) {
+				add_cpu_cycles(-NMI(0));
+			}
+		break;
 
-		setTextColor(specialColor);	drawText(0, 80, "DPAD, A, B, select start");
-		setTextColor(textColor);	drawText(8, 88, "matches the NES gamepad");
+		case EVENT_VBLANK_END:
+			// vblank ends (ppu_status D7) is set to 0, sprite_zero (ppu_status D6) and sprite overflow (ppu_status D5) are set to 0
+			ppu_status &= 0x1F;
 
-		setTextColor(specialColor);	drawText(0, 104, "Press C");
-		setTextColor(textColor);	drawText(8, 112, "toggle between 0-3 frameskip");
-									drawText(8, 120, "look dots on the lower left");
+			// and write to mem
+			write_memory(0x2002,ppu_status);
 
-		setTextColor(specialColor);	drawText(0, 136, "Hold LPAD");
-		setTextColor(textColor);	drawText(8, 144, "pauses rendering (CPU only running)");
+			loopyV = loopyT;
 
-		setTextColor(specialColor);	drawText(0, 160, "Press RPAD");
-		setTextColor(textColor);	drawText(8, 168, "switch faster renderer (incompatible)");
-									drawText(8, 176, "Works with Mario but fails with rest");
-									drawText(8, 184, "dot in upper right if fast renderer on");
+			startVisiblePart(when);
+		break;
 
-		setTextColor(bluerColor);
-		drawText(8, 204, "That's all folks!");
-		drawText(16, 212, "Press any button to continue!");
-		setTextColor(bugoColor); drawText(96, 230, "Bugo the Cat signing off..");
+		case EVENT_SPRITE0_HIT:
+			ppu_status |= 0x40;
+		break;
 
-		displayScreen();
+		case EVENT_SPRITE_OVERFLOW:
+			// sprite evaluation (and so the overflow flag) only happens while rendering is enabled
+			if (sprite_on || background_on) {
+				ppu_status |= 0x20;
+			}
+		break;
+
+		case EVENT_MAPPER_IRQ:
+			irq_line |= IRQ_SOURCE_MAPPER;
+			mmc3_irq_counter--;
+		break;
+
+		case EVENT_APU_FRAME_IRQ:
+			irq_line |= IRQ_SOURCE_APU_FRAME;
+			schedule_event(EVENT_APU_FRAME_IRQ, when + apuFrameIrqPeriod() * master_cycles_per_cpu_cycle);
+		break;
+
+		case EVENT_RENDER_CHECKPOINT:
+			// whatever the CPU didn't force out yet
+			renderLinesUntil(NES_screen_height - 1);
+			nextRenderLine = -1;
+			visibleStart = -1;
+			// an IRQ moved to the very end of the last line doesn't fire
+			cancel_event(EVENT_MAPPER_IRQ);
+
+			schedule_event(EVENT_VBLANK_START, when + start_int * master_cycles_per_cpu_cycle);
+		return true;
 	}
-	clearAllBuffers();
+
+	return false;
 }
 
-char *selectFileFromMenu()
+static void emulateFrame(bool render, bool present)
 {
-	int i;
-	char *romsDirectory = "Roms";
-	uint32 fileCount;
-	char *fileStr[MAX_FILES_NUM];
-
-	Directory      *dir;
-	DirectoryEntry  de;
-	char *selectedRom = NULL;
-	char dirRom[MAX_FILENAME_LENGTH + 4 + 1];
-
-	Item dirItem = OpenDiskFile(romsDirectory);
-	int selectIndex = 0;
-	const int maxFilesPerScreen = 30;
-	bool firstUpdate = true;
-	int prevFilePage = 0;
-	
-	const uint16 colorWhite = MakeRGB15(31, 31, 31);
-	const uint16 colorGrey = MakeRGB15(15, 15, 15);
-
-	// Read all the files from the Roms directory
-    dir = OpenDirectoryItem(dirItem);
-	fileCount = 0;
-	while (ReadDirectory(dir, &de) >= 0 && fileCount < MAX_FILES_NUM)
-	{
-		if (!(de.de_Flags & FILE_IS_DIRECTORY)) {
-			const int fileStrLen = returnStringLength(de.de_FileName);
-			if (fileStrLen > 0 && fileStrLen <= MAX_FILENAME_LENGTH) {
-				fileStr[fileCount] = (char*)AllocMem(fileStrLen, MEMTYPE_TRACKSIZE);
-				sprintf(fileStr[fileCount], "%s\0", de.de_FileName);
-				fileCount++;
-			}
+	bool frameDone = false;
+	master_clock_t when;
+	int type;
+
+	renderThisFrame = render;
+	renderLineStep = (renderer != RENDERER_PER_LINE) ? 8 : 1;
+
+	// The CPU always runs exactly until the next event, register and mapper writes catch the rendering up on their own
+	// and reschedule what they affect.
+	while (!frameDone) {
+		if (skipCPU) {
+			skip_to_next_event();
+		} else {
+			PROFILE_BEGIN(PROFILE_CPU);
+			run_cpu_until_next_event();
+			PROFILE_END(PROFILE_CPU);
 		}
-	}
-	CloseDirectory(dir);
-
-	// Main rom selection menu
-	while(!selectedRom) {
 
-		updateInput();
-
-		if (isJoyButtonPressedOnce(JOY_BUTTON_DOWN)) {
-			if (selectIndex < fileCount-1) ++selectIndex;
-		}
-		if (isJoyButtonPressedOnce(JOY_BUTTON_UP)) {
-			if (selectIndex > 0) --selectIndex;
-		}
-		if (isJoyButtonPressedOnce(JOY_BUTTON_LPAD)) {
-			selectIndex -= maxFilesPerScreen;
-			if (selectIndex < 0) selectIndex = 0;
-		}
-		if (isJoyButtonPressedOnce(JOY_BUTTON_RPAD)) {
-			selectIndex += maxFilesPerScreen;
-			if (selectIndex > fileCount-1) selectIndex = fileCount-1;
-		}
-		if (isJoyButtonPressedOnce(JOY_BUTTON_A)) {
-			selectedRom = fileStr[selectIndex];
+		while (!frameDone && (type = next_due_event(&when)) >= 0) {
+			frameDone = runFrameEvent(type, when);
 		}
+	}
 
-		if (wasAnyJoyButtonPressed() || firstUpdate) {
-			const int filePage = selectIndex / maxFilesPerScreen;
-			const int pageStartIndex = filePage * maxFilesPerScreen;
+	if (render) {
+		PROFILE_BEGIN(PROFILE_SPRITES);
+		render_sprites();
+		PROFILE_END(PROFILE_SPRITES);
+	}
 
-			if (filePage != prevFilePage) clearAllBuffers();
-			prevFilePage = filePage;
+	// Draw Screen
+	if (present) {
+		platform_video_present(render);
+	}
+}
 
-			for (i=0; i<maxFilesPerScreen; ++i) {
-				const int realIndex = pageStartIndex + i;
+static void runFramesAhead(bool present)
+{
+	// The frame is played without rendering, then from a snapshot of it the next runAheadFrames frames with the same input,
+	// the last one rendered and shown. Going back to the snapshot hides them, but the picture shows the game as if
+	// its internal lag frames had already gone by.
+	const uint32 startUs = platform_usec();
+	int i;
 
-				uint16 color = colorGrey;
-				if (selectIndex == realIndex) {
-					color = colorWhite;
-				}
+	if (!runAheadState) {
+		runAheadState = platform_alloc(SNAPSHOT_SIZE);
+		if (!runAheadState) {
+			runAheadFrames = 0;
+			emulateFrame(true, present);
+			return;
+		}
+	}
 
-				if (realIndex < fileCount) {
-					setTextColor(color);
-					drawText(0, i*8, fileStr[realIndex]);
-				}
-			}
+	emulateFrame(false, false);
+	snapshot_save(runAheadState);
 
-			displayScreen();
-			firstUpdate = false;
-		}
+	for (i=1; i<runAheadFrames; ++i) {
+		emulateFrame(false, false);
 	}
+	emulateFrame(true, present);
 
+	snapshot_load(runAheadState);
 
-	clearAllBuffers();
-	setTextColor(colorWhite);
+	run_ahead_us = platform_usec() - startUs;
+}
 
-	// Create the full rom folder/file string
-	sprintf(dirRom, "%s/%s\0", romsDirectory, selectedRom);
+void run_frame(bool render, bool present)
+{
+	PROFILE_NEXT_FRAME();
+	movie_frame_start();
+	run_ahead_us = 0;
 
-	// Free all the filename strings allocated
-	for (i=0; i<fileCount; ++i) {
-		FreeMem(fileStr[i], -1);
+	// frames not shown don't need to be ahead, and a movie plays its frames exactly once
+	if (runAheadFrames > 0 && render && movie_state() == MOVIE_OFF) {
+		runFramesAhead(present);
+	} else {
+		emulateFrame(render, present);
 	}
 
-	return dirRom;
+	movie_frame_end();
+}
+
+void soft_reset()
+{
+	// the reset button only restarts the CPU, memory and the cartridge keep their state
+	CPU_reset();
+	irq_line = 0;
 }
 
-void initLoad(char *filename)
+void power_cycle()
 {
-	if(analyze_header(filename) == 1)
-	{
-		free(sprite_memory);
-		free(ppu_memory);
-		free(memory);
-		exit(1);
+	if (powerOnState) {
+		snapshot_load(powerOnState);
 	}
+}
+
+
+static bool loadRom(char *filename)
+{
+	if (analyze_header(filename) == 1) return false;
 
 	// rom cache memory
-	romcache = (unsigned char *)AllocMem(romlen, MEMTYPE_ANY);
-
-	if (load_rom(filename) == 1)
-	{
-		free(sprite_memory);
-		free(ppu_memory);
-		free(memory);
-		free(romcache);
-		exit(1);
+	romcache = (unsigned char *)platform_alloc(romlen);
+	if (!romcache) return false;
+
+	if (load_rom(filename) == 1) {
+		platform_free(romcache);
+		romcache = NULL;
+		return false;
 	}
+	return true;
 }
 
-void initEmu()
+bool load_game(char *filename)
 {
 	// cpu speed
 	unsigned int NTSC_SPEED = 1789725;
@@ -553,18 +508,7 @@ void initEmu()
 	unsigned int NTSC_VBLANK_CYCLE_TIMEOUT = (NTSC_TOTAL_HEIGHT-NTSC_HEIGHT) * NTSC_VBLANK_INT / NTSC_TOTAL_HEIGHT;
 	unsigned int PAL_VBLANK_CYCLE_TIMEOUT = (PAL_TOTAL_HEIGHT-PAL_HEIGHT) * PAL_VBLANK_INT / PAL_TOTAL_HEIGHT;
 	
-	char *filename = NULL;
-	
-
-	showHelpScreen();
-
-	filename = selectFileFromMenu();
-	if (filename) {
-		initLoad(filename);
-	} else {
-		exit(1);
-	}
-
+	if (!loadRom(filename)) return false;
 
 	if (MAPPER == 4) {
 		mmc3_reset();
@@ -578,11 +522,11 @@ void initEmu()
 		NES_screen_height = PAL_HEIGHT;
 	} else if(systemType == SYSTEM_NTSC) {
 		NES_screen_height = NTSC_HEIGHT;
-	} else return;
+	} else return false;
 
 	init_ppu();
 
-	initNESscreenCELs();
+	if (!platform_video_init(NES_screen_width, NES_screen_height)) return false;
 	initNESpal3DO();
 
 	// first reset the cpu at poweron
@@ -602,10 +546,19 @@ void initEmu()
 		vblank_cycle_timeout = NTSC_VBLANK_CYCLE_TIMEOUT;
 		scanline_refresh = NTSC_SCANLINE_REFRESH;
 	}
-}
 
-int main()
-{
-	coreInit(initEmu, CORE_VRAM_SINGLEBUFFER | CORE_NO_CLEAR_FRAME | CORE_SHOW_FPS | CORE_NO_VSYNC);
-	coreRun(runEmu);
+	resetFrameEvents();
+
+	// tells this run's snapshots apart from any other's
+	snapshot_session = platform_ticks();
+	rewind_reset();
+
+	// a ROM loaded before had its own
+	platform_free(powerOnState);
+	powerOnState = platform_alloc(SNAPSHOT_SIZE);
+	if (powerOnState) {
+		snapshot_save(powerOnState);
+	}
+
+	return true;
 }
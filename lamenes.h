@@ -32,12 +32,14 @@
 #ifndef LAMENES_H
 #define LAMENES_H
 
-#include <graphics.h>
+#include "types.h"
 
 #define DEBUG_MEM_FREQS 0
 
 enum {SYSTEM_NTSC, SYSTEM_PAL};
 enum {RENDERER_PER_LINE, RENDERER_PER_TILE, RENDERER_GPU_TILE};
+// direct 16bpp colors, or 8bpp NES palette indices colored by a PLUT per 8 line row
+enum {OUTPUT_DIRECT_16BPP, OUTPUT_INDEXED_8BPP};
 
 extern char romfn[256];
 
@@ -45,21 +47,60 @@ extern unsigned char *romcache;
 
 extern int systemType;
 extern int renderer;
+extern int outputMode;
 
-extern CCB *screenCel;
+// 0 plays normally
+#define RUN_AHEAD_FRAMES 0
+extern int runAheadFrames;
+
+extern bool skipCPU;
+// what running ahead cost on the last frame shown (microseconds)
+extern uint32 run_ahead_us;
+
+// fine X scroll of each 8 line row, and the colors of each indexed row
 extern int scrollRowX[32];
-extern uint16 palette3DO[256];
+extern uint16 row_palette[32][32];
+extern bool row_palette_changed[32];
+extern bool present_all_rows;
+
+// palette banks are indexed by (emphasis << 1) | monochrome
+#define EMPHASIS_RED 1
+#define EMPHASIS_GREEN 2
+#define EMPHASIS_BLUE 4
+#define PALETTE_BANKS_NUM 16
+
+extern uint16 palette3DObanks[PALETTE_BANKS_NUM][256];
+extern uint16 *palette3DO;
 
 extern unsigned short NES_screen_width;
 extern unsigned short NES_screen_height;
 
-extern void load_state();
-extern void save_state();
-
 extern long romlen;
 
 extern void set_input();
 
+// loads the ROM and powers the NES on, false if it can't be played
+extern bool load_game(char *filename);
+// plays a frame, rendered or not, and shows it unless present is false
+extern void run_frame(bool render, bool present);
+// the next frame redraws the whole screen
+extern void invalidate_screen();
+
+extern void soft_reset();
+// back to the state right after the ROM was loaded
+extern void power_cycle();
+
+extern int current_scanline();
+extern void catch_up_rendering();
+extern void reschedule_mapper_irq();
+
+// devices on the CPU IRQ line (irq_line bits)
+#define IRQ_SOURCE_MAPPER 1
+#define IRQ_SOURCE_APU_FRAME 2
+
+extern void apu_frame_counter_write(unsigned char data);
+extern unsigned char apu_status_read();
+
 extern int mmc3_irq_counter;
 extern int mmc3_irq_enable;
 extern void mmc3_reset(void);
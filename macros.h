@@ -56,6 +56,7 @@
 #define sprite_clipping_off	(ppu_control2 & 0x04) /* 1 = 1 = No clipping */
 #define background_clipping_off	(ppu_control2 & 0x02) /* 1 = 1 = No clipping */
 #define monochrome_on		(ppu_control2 & 0x01) /* 1 = Display monochrome */
+#define color_emphasis		((ppu_control2 >> 5) & 7) /* D5-D7 = Emphasize red, green, blue (red/green swapped on PAL) */
 
 /* memory[0x2002] */
 #define vblank_on		(ppu_status & 0x80) /* 1 = In VBlank */
@@ -49,7 +49,7 @@ void cnrom_switch_chr(int bank)
 
 	chr_start = prg_size * PRG;
 
-	memcpy(ppu_memory + address, romcache + 16 + chr_start + (bank * chr_size), chr_size);
+	ppu_load_chr(address, romcache + 16 + chr_start + (bank * chr_size), chr_size);
 }
 
 void cnrom_access(unsigned int address,unsigned char data)
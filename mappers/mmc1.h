@@ -34,6 +34,7 @@
  */
  
 #include "string.h"
+#include <stdlib.h>
 
 int mmc1_PRGROM_area_switch;
 int mmc1_PRGROM_bank_switch;
@@ -74,7 +75,7 @@ mmc1_switch_prg(int bank, int pagesize, int area)
 		exit(1);
 	}
 
-	memcpy(memory + address, romcache + 16 + (bank * prg_size), prg_size); 
+	cpu_load_prg(address, romcache + 16 + (bank * prg_size), prg_size);
 }
 
 void
@@ -107,7 +108,7 @@ mmc1_switch_chr(int bank, int pagesize, int area) {
 		exit(1);
 	}
 
-	memcpy(ppu_memory + address, romcache + 16 + chr_start + (bank * chr_size), chr_size); 
+	ppu_load_chr(address, romcache + 16 + chr_start + (bank * chr_size), chr_size);
 }
 
 void
@@ -125,20 +126,23 @@ mmc1_access(unsigned int address,unsigned char data)
 		}
 
 		if(mmc1_reg0_bitcount == 5) {
-			/* set horizontal/vertical mirroring */
-			if(mmc1_reg0_data & 0x01) {
-				/* set to horizontal */
-				MIRRORING = 0;
-			} else {
-				/* set to vertical */
-				MIRRORING = 1;
-			}
-
-			/* set h/v or one screen mirroring */
-			if(mmc1_reg0_data & 0x02) {
-				OS_MIRROR = 1;
-			} else {
-				OS_MIRROR = 0;
+			/* set one screen (lower/upper bank), vertical or horizontal mirroring */
+			switch(mmc1_reg0_data & 0x03) {
+				case 0:
+				ppu_set_mirroring(MIRROR_ONE_SCREEN_LO);
+				break;
+
+				case 1:
+				ppu_set_mirroring(MIRROR_ONE_SCREEN_HI);
+				break;
+
+				case 2:
+				ppu_set_mirroring(MIRROR_VERTICAL);
+				break;
+
+				case 3:
+				ppu_set_mirroring(MIRROR_HORIZONTAL);
+				break;
 			}
 
 			/* switch the low/high prg rom area */
@@ -51,7 +51,7 @@ int mmc3_irq_enable = 0;
 void
 mmc3_reset()
 {
-	memcpy(memory + 0xa000, romcache + 16, 8192);
+	cpu_load_prg(0xa000, romcache + 16, 8192);
 }
 
 void
@@ -61,7 +61,7 @@ mmc3_switch_prg(unsigned int address, int bank)
 
 	prg_size = 8192;
 
-	memcpy(memory + address, romcache + 16 + (bank * prg_size), prg_size); 
+	cpu_load_prg(address, romcache + 16 + (bank * prg_size), prg_size);
 }
 
 void
@@ -76,7 +76,7 @@ mmc3_switch_chr(unsigned int address, int bank, int pagecount)
 
 	chr_start = prg_size * PRG;
 
-	memcpy(ppu_memory + address, romcache + 16 + chr_start + (bank * chr_size), chr_size * pagecount); 
+	ppu_load_chr(address, romcache + 16 + chr_start + (bank * chr_size), chr_size * pagecount);
 }
 
 void
@@ -187,11 +187,9 @@ mmc3_access(unsigned int address,unsigned char data)
 
 		/* set horizontal/vertical mirroring */
 		if(data & 0x01) {
-			/* set to vertical */
-			MIRRORING = 1;
+			ppu_set_mirroring(MIRROR_HORIZONTAL);
 		} else {
-			/* set to horizontal */
-			MIRRORING = 0;
+			ppu_set_mirroring(MIRROR_VERTICAL);
 		}
 		break;
 
@@ -217,6 +215,8 @@ mmc3_access(unsigned int address,unsigned char data)
 
 		mmc3_irq_counter = mmc3_irq_latch;
 		mmc3_irq_enable = 0;
+		// also acknowledges a pending IRQ
+		irq_line &= ~IRQ_SOURCE_MAPPER;
 		break;
 
 		case 0xe001:
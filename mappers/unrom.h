@@ -41,7 +41,7 @@ void unrom_switch_prg(int bank)
 	address = 0x8000;
 	prg_size = 16384;
 
-	memcpy(memory + address, romcache + 16 + (bank * prg_size), prg_size);
+	cpu_load_prg(address, romcache + 16 + (bank * prg_size), prg_size);
 }
 
 void unrom_access(unsigned int address,unsigned char data)
@@ -36,6 +36,7 @@
 #include "macros.h"
 #include "lamenes.h"
 #include "romloader.h"
+#include "state.h"
 
 // included mappers
 #include "mappers/mmc1.h"	// 1
@@ -44,14 +45,17 @@
 #include "mappers/mmc3.h"	// 4
 
 char *savfile;
-char *statefile;
 
-int pad1_readcount = 0;
 
 unsigned char memory[CPU_MEMORY];
 unsigned char ppu_memory[PPU_MEMORY];
 unsigned char sprite_memory[SPRITE_MEMORY];
 
+unsigned char memory_page_dirty[CPU_MEMORY >> 8];
+
+// ROM bank copied into each 8KB page of $8000-$FFFF
+static const unsigned char *prg_page_src[4];
+
 // FILE *sav_fp;
 
 /*
@@ -74,162 +78,99 @@ void write_sav()
 	fwrite(&memory[0x6000],1,8192,sav_fp);
 	fclose(sav_fp);
 }
+*/
 
-void load_state()
+void cpu_load_prg(unsigned int address, const unsigned char *src, int size)
 {
-	int pf;
-
-	FILE *lst_fp;
-
-	fprintf(stdout,"[*] loading state from file: %s\n",statefile);
-
-	lst_fp = fopen(statefile,"rb");
-
-	if(lst_fp) {
-		fread(&program_counter,1,2,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,2,SEEK_CUR);
-		fread(&stack_pointer,1,1,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,3,SEEK_CUR);
-		fread(&status_register,1,1,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,4,SEEK_CUR);
-		fread(&x_reg,1,1,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,5,SEEK_CUR);
-		fread(&y_reg,1,1,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,6,SEEK_CUR);
-		fread(&accumulator,1,1,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,7,SEEK_CUR);
-		fread(&pf,1,1,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,8,SEEK_CUR);
-		fread(&ppu_control1,1,2,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,10,SEEK_CUR);
-		fread(&ppu_control2,1,2,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,13,SEEK_CUR);
-		fread(&ppu_addr_h,1,2,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,14,SEEK_CUR);
-		fread(&ppu_addr,1,2,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,16,SEEK_CUR);
-		fread(&ppu_addr_tmp,1,2,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,18,SEEK_CUR);
-		fread(&ppu_status,1,2,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,20,SEEK_CUR);
-		fread(&ppu_status_tmp,1,2,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,22,SEEK_CUR);
-		fread(&sprite_address,1,2,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,24,SEEK_CUR);
-		fread(&ppu_bgscr_f,1,2,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,26,SEEK_CUR);
-		fread(&loopyT,1,2,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,28,SEEK_CUR);
-		fread(&loopyV,1,2,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,30,SEEK_CUR);
-		fread(&loopyX,1,2,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,32,SEEK_CUR);
-		fread(&memory[0x0000],1,65536,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,65568,SEEK_CUR);
-		fread(&ppu_memory[0x0000],1,16384,lst_fp);
-
-		fseek(lst_fp,0,SEEK_SET);
-		fseek(lst_fp,81952,SEEK_CUR);
-		fread(&sprite_memory[0x0000],1,256,lst_fp);
-
-		SET_SAR(pf)
-
-		fclose(lst_fp);
-
-		fprintf(stdout,"[*] done!\n");
-	} else {
-		fprintf(stdout,"[!] no save state file found!\n");
+	// Mapper PRG ROM switches copy 8KB pages, like ppu_load_chr pages already holding the same bank are left alone.
+	// Snapshots keep which bank each page holds rather than the bytes, loading one maps them back in through here.
+	int page;
+
+	for (page = (address - 0x8000) >> 13; size > 0; ++page) {
+		if (prg_page_src[page] != src) {
+			memcpy(memory + 0x8000 + (page << 13), src, 8192);
+			prg_page_src[page] = src;
+		}
+		src += 8192;
+		size -= 8192;
 	}
 }
 
-void save_state()
+void cpu_unmap_prg()
 {
-	int pf;
-
-	FILE *sst_fp;
-
-	fprintf(stdout,"[*] saving state to file: %s\n",statefile);
-
-	sst_fp = fopen(statefile,"wb");
+	// a new romcache might sit where the last one was
+	int page;
 
-	pf = ((sign_flag ? 0x80 : 0) |
-		(zero_flag ? 0x02 : 0) |
-		(carry_flag ? 0x01 : 0) |
-		(interrupt_flag ? 0x04 : 0) |
-		(decimal_flag ? 0x08 : 0) |
-		(overflow_flag ? 0x40 : 0) |
-		(break_flag ? 0x10 : 0) | 0x20);
-
-	fwrite(&program_counter,1,2,sst_fp);
-	fwrite(&stack_pointer,1,1,sst_fp);
-	fwrite(&status_register,1,1,sst_fp);
-	fwrite(&x_reg,1,1,sst_fp);
-	fwrite(&y_reg,1,1,sst_fp);
-	fwrite(&accumulator,1,1,sst_fp);
-	fwrite(&pf,1,1,sst_fp);
-
-	fwrite(&ppu_control1,1,2,sst_fp);
-	fwrite(&ppu_control2,1,2,sst_fp);
-	fwrite(&ppu_addr_h,1,2,sst_fp);
-	fwrite(&ppu_addr,1,2,sst_fp);
-	fwrite(&ppu_addr_tmp,1,2,sst_fp);
-	fwrite(&ppu_status,1,2,sst_fp);
-	fwrite(&ppu_status_tmp,1,2,sst_fp);
-	fwrite(&sprite_address,1,2,sst_fp);
-	fwrite(&ppu_bgscr_f,1,2,sst_fp);
+	for (page=0; page<4; ++page) {
+		prg_page_src[page] = NULL;
+	}
+}
 
-	fwrite(&loopyT,1,2,sst_fp);
-	fwrite(&loopyV,1,2,sst_fp);
-	fwrite(&loopyX,1,2,sst_fp);
+void mapper_save_state(MapperState *s)
+{
+	int i;
+
+	s->mmc1_reg_data[0] = mmc1_reg0_data;
+	s->mmc1_reg_data[1] = mmc1_reg1_data;
+	s->mmc1_reg_data[2] = mmc1_reg2_data;
+	s->mmc1_reg_data[3] = mmc1_reg3_data;
+	s->mmc1_reg_bitcount[0] = mmc1_reg0_bitcount;
+	s->mmc1_reg_bitcount[1] = mmc1_reg1_bitcount;
+	s->mmc1_reg_bitcount[2] = mmc1_reg2_bitcount;
+	s->mmc1_reg_bitcount[3] = mmc1_reg3_bitcount;
+	s->mmc1_prgrom_area_switch = mmc1_PRGROM_area_switch;
+	s->mmc1_prgrom_bank_switch = mmc1_PRGROM_bank_switch;
+	s->mmc1_chrrom_bank_switch = mmc1_CHRROM_bank_switch;
+
+	s->mmc3_cmd = mmc3_cmd;
+	s->mmc3_prg_bank0 = mmc3_prg_bank0;
+	s->mmc3_prg_bank1 = mmc3_prg_bank1;
+	s->mmc3_prg_page = mmc3_prg_page;
+	s->mmc3_chr_xor = mmc3_chr_xor;
+	s->mmc3_irq_counter = mmc3_irq_counter;
+	s->mmc3_irq_latch = mmc3_irq_latch;
+	s->mmc3_irq_control0 = mmc3_irq_control0;
+	s->mmc3_irq_control1 = mmc3_irq_control1;
+	s->mmc3_irq_enable = mmc3_irq_enable;
+	s->unused = 0;
+
+	for (i=0; i<4; ++i) {
+		s->prg_rom_offset[i] = prg_page_src[i] - romcache;
+	}
+}
 
-	fwrite(&memory[0x0000],1,65536,sst_fp);
-	fwrite(&ppu_memory[0x0000],1,16384,sst_fp);
-	fwrite(&sprite_memory[0x0000],1,256,sst_fp);
+void mapper_load_state(const MapperState *s)
+{
+	// the PRG ROM banks are mapped back in, the CHR banks are in the PPU memory of the snapshot
+	int i;
 
-	fclose(sst_fp);
+	for (i=0; i<4; ++i) {
+		cpu_load_prg(0x8000 + (i << 13), romcache + s->prg_rom_offset[i], 8192);
+	}
 
-	fprintf(stdout,"[*] done!\n");
-}*/
+	mmc1_reg0_data = s->mmc1_reg_data[0];
+	mmc1_reg1_data = s->mmc1_reg_data[1];
+	mmc1_reg2_data = s->mmc1_reg_data[2];
+	mmc1_reg3_data = s->mmc1_reg_data[3];
+	mmc1_reg0_bitcount = s->mmc1_reg_bitcount[0];
+	mmc1_reg1_bitcount = s->mmc1_reg_bitcount[1];
+	mmc1_reg2_bitcount = s->mmc1_reg_bitcount[2];
+	mmc1_reg3_bitcount = s->mmc1_reg_bitcount[3];
+	mmc1_PRGROM_area_switch = s->mmc1_prgrom_area_switch;
+	mmc1_PRGROM_bank_switch = s->mmc1_prgrom_bank_switch;
+	mmc1_CHRROM_bank_switch = s->mmc1_chrrom_bank_switch;
+
+	mmc3_cmd = s->mmc3_cmd;
+	mmc3_prg_bank0 = s->mmc3_prg_bank0;
+	mmc3_prg_bank1 = s->mmc3_prg_bank1;
+	mmc3_prg_page = s->mmc3_prg_page;
+	mmc3_chr_xor = s->mmc3_chr_xor;
+	mmc3_irq_counter = s->mmc3_irq_counter;
+	mmc3_irq_latch = s->mmc3_irq_latch;
+	mmc3_irq_control0 = s->mmc3_irq_control0;
+	mmc3_irq_control1 = s->mmc3_irq_control1;
+	mmc3_irq_enable = s->mmc3_irq_enable;
+}
 
 int mr_nohw = 0;
 int mr_hw = 0;
@@ -247,6 +188,11 @@ unsigned char memory_read(unsigned int address) {
         if (DEBUG_MEM_FREQS) mr_hw++;
     }
 
+	// PPU registers are mirrored every 8 bytes up to $3FFF
+	if(address < 0x4000) {
+		address = 0x2000 | (address & 7);
+	}
+
 	// the addresses between 0x2000 and 0x5000 are for input/ouput
 	if(address == 0x2002) {
 		ppu_status_tmp = ppu_status;
@@ -282,65 +228,30 @@ unsigned char memory_read(unsigned int address) {
 		}
         if (DEBUG_MEM_FREQS) mr_0x2007++;
 
-		return ppu_memory[tmp];
+		return read_ppu_memory(tmp);
 	}
 
-	// pAPU data (sound)
-	/*
+	// pAPU status, sound isn't emulated but the frame interrupt flag is
 	if(address == 0x4015) {
-		return memory[address];
+		return apu_status_read();
 	}
-	*/
 	
-	// joypad1 data
-	if(address == 0x4016) {
-		switch(pad1_readcount) {
-			case 0:
-			memory[address] = pad1[PAD_A];
-			pad1_readcount++;
-			break;
-
-			case 1:
-			memory[address] = pad1[PAD_B];
-			pad1_readcount++;
-			break;
-
-			case 2:
-			memory[address] = pad1[PAD_SELECT];
-			pad1_readcount++;
-			break;
-
-			case 3:
-			memory[address] = pad1[PAD_START];
-			pad1_readcount++;
-			break;
-
-			case 4:
-			memory[address] = pad1[PAD_UP];
-			pad1_readcount++;
-			break;
-
-			case 5:
-			memory[address] = pad1[PAD_DOWN];
-			pad1_readcount++;
-			break;
-
-			case 6:
-			memory[address] = pad1[PAD_LEFT];
-			pad1_readcount++;
-			break;
-
-			case 7:
-			memory[address] = pad1[PAD_RIGHT];
-			pad1_readcount = 0;
-			break;
-		}
+	// joypad data, the port's shift register hands out a button per read and 1s once it's empty
+	if(address == 0x4016 || address == 0x4017) {
+		const int port = address - 0x4016;
+		unsigned char bit;
+
+		latchNesInput();
+		if (INPUT_LATENCY_TEST) measureInputLatency();
         if (DEBUG_MEM_FREQS) mr_0x4016++;
-	}
 
-	/*if(address == 0x4017) {
-		return memory[address];
-	}*/
+		// with the strobe high it keeps reloading, so it's always the A button
+		if (pad_strobe) return 0x40 | (pad_state[port] & 1);
+
+		bit = pad_shift[port] & 1;
+		pad_shift[port] = (pad_shift[port] >> 1) | 0x80;
+		return 0x40 | bit;
+	}
 
 	return memory[address];
 }
@@ -363,9 +274,11 @@ void write_memory(unsigned int address,unsigned char data)
 		return;
 	}
 
-	// RAM registers
-	if(address < 0x800) {
+	// RAM registers, written through any of the mirrors
+	if(address < 0x2000) {
+		address &= 0x7ff;
 		memory[address] = data;
+		memory_page_dirty[address >> 8] = 1;
 		memory[address+2048] = data; // mirror of 0-0x800
 		memory[address+4096] = data; // mirror of 0-0x800
 		memory[address+6144] = data; // mirror of 0-0x800
@@ -373,27 +286,34 @@ void write_memory(unsigned int address,unsigned char data)
 		return;
 	}
 
-	// PPU Video Memory area
+	// PPU registers, 8 of them mirrored all over $2000-$3FFF
 	if(address > 0x1fff && address < 0x4000) {
-		write_ppu_memory(address,data);
+		write_ppu_register(address & 7,data);
         if (DEBUG_MEM_FREQS) mw_ppu++;
 		return;
 	}
 
 	// Sprite DMA Register
 	if(address == 0x4014) {
-		write_ppu_memory(address,data);
+		ppu_sprite_dma(data);
         if (DEBUG_MEM_FREQS) mw_0x4014++;
 		return;
 	}
 
 	// Joypad 1
 	if(address == 0x4016) {
-		memory[address] = 0x40;
+		strobeNesInput(data);
         if (DEBUG_MEM_FREQS) mw_0x4016++;
 		return;
 	}
 
+	// pAPU frame counter
+	if(address == 0x4017) {
+		apu_frame_counter_write(data);
+		memory[address] = data;
+		return;
+	}
+
 	// Joypad 2
 	/*if(address == 0x4017) {
 		memory[address] = 0x48;
@@ -423,10 +343,20 @@ void write_memory(unsigned int address,unsigned char data)
 	if (DEBUG_MEM_FREQS) mw_other++;
 
 	if (MAPPER==0) {
-		memory[address] = data;
+		// no registers above $8000, and the ROM there stays as it is
+		if (address < 0x8000) {
+			memory[address] = data;
+			memory_page_dirty[address >> 8] = 1;
+		}
 		return;
 	}
 
+	// none of the mappers decode the I/O and work RAM below $8000, only their registers move banks or the IRQ
+	if (address < 0x8000) return;
+
+	// bank switches and mirroring only apply to the lines not started yet
+	catch_up_rendering();
+
 	switch(MAPPER) {
 		case 1:
 			mmc1_access(address,data);
@@ -447,4 +377,7 @@ void write_memory(unsigned int address,unsigned char data)
 		default:
 		break;
 	}
+
+	// a mapper write may have moved its IRQ
+	reschedule_mapper_irq();
 }
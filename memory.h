@@ -53,6 +53,13 @@ extern int mw_0x4016;
 extern int mw_mirror_low;
 extern int mw_other;
 
+// 256 byte pages of CPU memory written to since the last rewind point, RAM writes only mark the first of its mirrors
+// and the ROM banks switched aren't marked, the mapper state has them
+extern unsigned char memory_page_dirty[CPU_MEMORY >> 8];
+
+void cpu_load_prg(unsigned int address, const unsigned char *src, int size);
+// before mapping the banks of a ROM just loaded
+void cpu_unmap_prg();
 unsigned char memory_read(unsigned int address);
 void write_memory(unsigned int address,unsigned char data);
 
@@ -0,0 +1,334 @@
+/*
+ * movie.c - input movie recording and playback
+ */
+
+#include <string.h>
+
+#include "lamenes.h"
+#include "nes_input.h"
+#include "state.h"
+#include "movie.h"
+#include "platform.h"
+
+#define MOVIE_MAGIC 0x4C4E4D56	// "LNMV"
+
+// frames the recording buffer grows by, a minute at 60Hz
+#define MOVIE_GROW_FRAMES 3600
+
+static int state = MOVIE_OFF;
+
+// the whole movie, header included
+static uint8 *movie = NULL;
+static int movieSize = 0;
+static int movieCapacity = 0;
+static int frameData = 0;
+static int frames = 0;
+
+static int frame = 0;
+// applied since the last frame, recorded with the next one
+static int pendingEvents = 0;
+static int frameEvents = 0;
+// the pads every latch of this frame gives, recording polls them on the first one
+static unsigned char framePads[NES_PADS];
+static bool framePadsSet = false;
+
+static uint32 crcTable[256];
+static bool crcTableDone = false;
+
+
+uint32 crc32_update(uint32 crc, const void *data, int size)
+{
+	const uint8 *p = (const uint8*)data;
+	int i, b;
+
+	if (!crcTableDone) {
+		for (i=0; i<256; ++i) {
+			uint32 c = i;
+			for (b=0; b<8; ++b) {
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			}
+			crcTable[i] = c;
+		}
+		crcTableDone = true;
+	}
+
+	crc = ~crc;
+	for (i=0; i<size; ++i) {
+		crc = crcTable[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static uint32 get32(const uint8 *p)
+{
+	return ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | p[3];
+}
+
+static void put32(uint8 *p, uint32 v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static int snapshotByteOrder()
+{
+	// the flag this machine's snapshots are recorded with
+	const uint32 one = 1;
+
+	return (*(const uint8*)&one == 0) ? MOVIE_SNAPSHOT_BIG_ENDIAN : 0;
+}
+
+static uint32 romCrc()
+{
+	return crc32_update(0, romcache, romlen);
+}
+
+static bool reserve(int size)
+{
+	uint8 *grown;
+
+	if (size <= movieCapacity) return true;
+
+	// no realloc behind the platform, the frames so far are copied over
+	grown = (uint8*)platform_alloc(size);
+	if (!grown) return false;
+
+	if (movie) memcpy(grown, movie, movieSize);
+	platform_free(movie);
+	movie = grown;
+	movieCapacity = size;
+	return true;
+}
+
+static void forget()
+{
+	platform_free(movie);
+	movie = NULL;
+	movieSize = movieCapacity = 0;
+	frames = 0;
+}
+
+static void start(int newState)
+{
+	state = newState;
+	frame = 0;
+	pendingEvents = 0;
+	frameEvents = 0;
+	memset(framePads, 0, sizeof(framePads));
+	framePadsSet = false;
+}
+
+int movie_state()
+{
+	return state;
+}
+
+int movie_frame()
+{
+	return frame;
+}
+
+int movie_frames()
+{
+	return frames;
+}
+
+bool movie_record(bool fromSnapshot)
+{
+	const int snapshotSize = fromSnapshot ? SNAPSHOT_SIZE : 0;
+
+	movie_stop();
+	forget();
+
+	if (!reserve(MOVIE_HEADER_SIZE + snapshotSize + MOVIE_GROW_FRAMES * MOVIE_FRAME_BYTES)) return false;
+
+	if (!fromSnapshot) {
+		power_cycle();
+	}
+
+	memcpy(movie, "LNMV", 4);
+	put32(movie + 4, MOVIE_VERSION);
+	put32(movie + 8, fromSnapshot ? MOVIE_FROM_SNAPSHOT | snapshotByteOrder() : 0);
+	put32(movie + 12, romCrc());
+	put32(movie + 16, 0);
+	put32(movie + 20, snapshotSize);
+
+	frameData = MOVIE_HEADER_SIZE + snapshotSize;
+	if (fromSnapshot) {
+		// the buffer comes from platform_alloc, aligned enough for the snapshot
+		snapshot_save(movie + MOVIE_HEADER_SIZE);
+	}
+	movieSize = frameData;
+
+	start(MOVIE_RECORDING);
+	return true;
+}
+
+bool movie_play(const void *data, int size)
+{
+	const uint8 *p = (const uint8*)data;
+	uint32 flags, snapshotSize, count;
+
+	movie_stop();
+
+	if (size < MOVIE_HEADER_SIZE || get32(p) != MOVIE_MAGIC || get32(p + 4) != MOVIE_VERSION) return false;
+
+	flags = get32(p + 8);
+	count = get32(p + 16);
+	snapshotSize = get32(p + 20);
+	if (get32(p + 12) != romCrc()) return false;
+	if ((flags & MOVIE_FROM_SNAPSHOT) ? snapshotSize != SNAPSHOT_SIZE : snapshotSize != 0) return false;
+	if ((flags & MOVIE_FROM_SNAPSHOT) && (flags & MOVIE_SNAPSHOT_BIG_ENDIAN) != snapshotByteOrder()) return false;
+	// unsigned and one bound at a time, so no count in the file can wrap past the check
+	if (snapshotSize > (uint32)(size - MOVIE_HEADER_SIZE)) return false;
+	if (count > ((uint32)(size - MOVIE_HEADER_SIZE) - snapshotSize) / MOVIE_FRAME_BYTES) return false;
+
+	if (p != movie) {
+		forget();
+		if (!reserve(size)) return false;
+		memcpy(movie, p, size);
+		movieSize = size;
+	}
+	frames = count;
+	frameData = MOVIE_HEADER_SIZE + snapshotSize;
+
+	if (flags & MOVIE_FROM_SNAPSHOT) {
+		if (snapshot_load(movie + MOVIE_HEADER_SIZE) != 0) return false;
+	} else {
+		power_cycle();
+	}
+
+	start(MOVIE_PLAYING);
+	return true;
+}
+
+bool movie_load(char *filename)
+{
+	PlatformFile *fp;
+	int size;
+	bool ok;
+
+	fp = platform_file_open(filename);
+	if (fp == NULL) return false;
+
+	movie_stop();
+	forget();
+
+	size = platform_file_size(fp);
+	ok = size > 0 && reserve(size) && platform_file_read(fp, movie, size) == size;
+	if (ok) {
+		movieSize = size;
+	}
+	platform_file_close(fp);
+
+	return ok && movie_play(movie, movieSize);
+}
+
+bool movie_save(char *filename)
+{
+	return movie != NULL && platform_file_write(filename, movie, movieSize);
+}
+
+void movie_stop()
+{
+	state = MOVIE_OFF;
+}
+
+const uint8 *movie_data(int *size)
+{
+	*size = movieSize;
+	return movie;
+}
+
+void movie_event(int event)
+{
+	if (event == MOVIE_EVENT_POWER) {
+		power_cycle();
+	} else {
+		soft_reset();
+	}
+
+	if (state == MOVIE_RECORDING) pendingEvents |= event;
+}
+
+void movie_frame_start()
+{
+	const uint8 *f;
+	int i;
+
+	if (state == MOVIE_RECORDING) {
+		frameEvents = pendingEvents;
+		pendingEvents = 0;
+		framePadsSet = false;
+	}
+
+	if (state != MOVIE_PLAYING) return;
+
+	if (frame >= frames) {
+		movie_stop();
+		return;
+	}
+
+	f = movie + frameData + frame * MOVIE_FRAME_BYTES;
+	for (i=0; i<NES_PADS; ++i) {
+		framePads[i] = f[i];
+	}
+	if (f[NES_PADS] & MOVIE_EVENT_POWER) power_cycle();
+	if (f[NES_PADS] & MOVIE_EVENT_RESET) soft_reset();
+}
+
+void movie_frame_end()
+{
+	uint8 *f;
+	int i;
+
+	if (state == MOVIE_PLAYING) {
+		frame++;
+		return;
+	}
+
+	if (state != MOVIE_RECORDING) return;
+
+	if (movieSize + MOVIE_FRAME_BYTES > movieCapacity && !reserve(movieCapacity + MOVIE_GROW_FRAMES * MOVIE_FRAME_BYTES)) {
+		// out of memory, the movie ends here
+		movie_stop();
+		return;
+	}
+
+	// a frame that didn't read the pads records the previous frame's
+	f = movie + movieSize;
+	for (i=0; i<NES_PADS; ++i) {
+		f[i] = framePads[i];
+	}
+	f[NES_PADS] = frameEvents;
+	movieSize += MOVIE_FRAME_BYTES;
+
+	frames = ++frame;
+	put32(movie + 16, frames);
+}
+
+bool movie_input(unsigned char *pads)
+{
+	int i;
+
+	if (state == MOVIE_OFF || (state == MOVIE_RECORDING && !framePadsSet)) return false;
+
+	for (i=0; i<NES_PADS; ++i) {
+		pads[i] = framePads[i];
+	}
+	return true;
+}
+
+void movie_record_input(const unsigned char *pads)
+{
+	int i;
+
+	if (state != MOVIE_RECORDING) return;
+
+	for (i=0; i<NES_PADS; ++i) {
+		framePads[i] = pads[i];
+	}
+	framePadsSet = true;
+}
@@ -0,0 +1,65 @@
+/*
+ * movie.h - input movie recording and playback
+ *
+ * A movie starts from power on or from a snapshot stored in it, and then holds for every frame the
+ * two pad bytes the game latched and the reset or power events applied before it. Played back, the
+ * pads come from the movie and the host input is never looked at, so the same movie gives the same
+ * frames in any build.
+ *
+ * Layout, header fields big endian:
+ *	"LNMV", version, flags, ROM CRC-32, frames, snapshot size
+ *	the snapshot, if any
+ *	MOVIE_FRAME_BYTES per frame
+ *
+ * The snapshot is kept in the byte order of the machine that recorded it, which the flags tell, and a
+ * movie starting from one only plays where the byte order is the same.
+ */
+
+#ifndef LAMENES_MOVIE_H
+#define LAMENES_MOVIE_H
+
+#include "types.h"
+
+#define MOVIE_VERSION 1
+#define MOVIE_HEADER_SIZE 24
+
+// header flags
+#define MOVIE_FROM_SNAPSHOT 1
+#define MOVIE_SNAPSHOT_BIG_ENDIAN 2
+
+// per frame: pad 1, pad 2, events
+#define MOVIE_FRAME_BYTES 3
+#define MOVIE_EVENT_RESET 1
+#define MOVIE_EVENT_POWER 2
+
+enum {MOVIE_OFF, MOVIE_RECORDING, MOVIE_PLAYING};
+
+extern int movie_state();
+
+// starts recording after a power cycle, or from the current state
+extern bool movie_record(bool fromSnapshot);
+// data is copied, returns false if it isn't a movie of this version for the loaded ROM
+extern bool movie_play(const void *data, int size);
+extern bool movie_load(char *filename);
+// writes the last movie recorded or played, where the platform can write files
+extern bool movie_save(char *filename);
+// recording keeps the movie, available from movie_data until the next one starts
+extern void movie_stop();
+extern const uint8 *movie_data(int *size);
+extern int movie_frame();
+// frames of the last movie recorded or played, past any snapshot in it
+extern int movie_frames();
+
+// resets or power cycles the NES, recorded into the movie if there's one recording
+extern void movie_event(int event);
+
+// around each frame played
+extern void movie_frame_start();
+extern void movie_frame_end();
+// fills the pads with this frame's, false when they come from the host (then given to movie_record_input)
+extern bool movie_input(unsigned char *pads);
+extern void movie_record_input(const unsigned char *pads);
+
+extern uint32 crc32_update(uint32 crc, const void *data, int size);
+
+#endif
@@ -32,37 +32,93 @@
 
 #include "lamenes.h"
 #include "nes_input.h"
+#include "scheduler.h"
+#include "movie.h"
+#include "platform.h"
 
-#include "3DO/input.h"
 
+unsigned char pad_state[NES_PADS];
+unsigned char pad_shift[NES_PADS];
+unsigned char pad_strobe = 0;
 
-unsigned char pad1[PAD_BUTTONS_NUM];
+// the pads are polled once per frame, when the game first strobes or reads them
+bool pad_latched = false;
+static bool measuredThisFrame = false;
+static master_clock_t latchClock = 0;
+static master_clock_t hostPollClock = 0;
 
-// Corresponds to 3DO/input.h JOY_BUTTONS enums
-static int joyButtonsMap[JOY_BUTTONS_NUM] = { 
-	PAD_UP, PAD_DOWN, PAD_LEFT, PAD_RIGHT,
-	PAD_B, PAD_A,
-	PAD_PAUSE_EMU, PAD_LOAD_STATE, PAD_SAVE_STATE,
-	PAD_SELECT, PAD_START
-};
+int input_latency_cycles = 0;
+int input_host_poll_age = 0;
 
 
-void updateNesInput()
+static void pollNesInput()
 {
-	int i;
-	for (i=0; i<JOY_BUTTONS_NUM; ++i) {
-		if (isJoyButtonPressed(i)) {
-			pad1[joyButtonsMap[i]] = 0x01;
-		} else {
-			pad1[joyButtonsMap[i]] = 0x40;
+	int pad;
+
+	for (pad=0; pad<NES_PADS; ++pad) {
+		pad_state[pad] = platform_read_pad(pad);
+	}
+}
+
+void startNesInputFrame()
+{
+	pad_latched = false;
+}
+
+void markHostInputPoll()
+{
+	hostPollClock = cpu_master_clock();
+}
+
+void latchNesInput()
+{
+	// Polling right before the game looks saves the better part of a frame over polling with the host frame,
+	// and costs nothing more.
+	if (pad_latched) return;
+	pad_latched = true;
+
+	// a movie playing replaces the pads, one recording gets them
+	if (!movie_input(pad_state)) {
+		pollNesInput();
+		movie_record_input(pad_state);
+	}
+	latchClock = cpu_master_clock();
+	measuredThisFrame = false;
+}
+
+void strobeNesInput(unsigned char data)
+{
+	// the shift registers keep reloading while the strobe bit is high and hold what they had when it drops
+	int pad;
+
+	latchNesInput();
+
+	if (pad_strobe || (data & 1)) {
+		for (pad=0; pad<NES_PADS; ++pad) {
+			pad_shift[pad] = pad_state[pad];
 		}
 	}
+	pad_strobe = data & 1;
+}
+
+void measureInputLatency()
+{
+	// the game read the first button, how long ago were the pads polled, and how long ago the host frame polled them
+	const master_clock_t now = cpu_master_clock();
+
+	if (measuredThisFrame) return;
+	measuredThisFrame = true;
+
+	input_latency_cycles = (int)(now - latchClock) / master_cycles_per_cpu_cycle;
+	input_host_poll_age = (int)(now - hostPollClock) / master_cycles_per_cpu_cycle;
 }
 
 void resetNesInput()
 {
-	int i;
-	for (i=0; i<PAD_BUTTONS_NUM; ++i) {
-		pad1[i] = 0x40;
+	int pad;
+	for (pad=0; pad<NES_PADS; ++pad) {
+		pad_state[pad] = 0;
+		pad_shift[pad] = 0;
 	}
+	pad_strobe = 0;
 }
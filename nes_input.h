@@ -32,16 +32,40 @@
 #ifndef LAMENES_INPUT_H
 #define LAMENES_INPUT_H
 
-enum {	PAD_UP, PAD_DOWN, PAD_LEFT, PAD_RIGHT, 
-		PAD_A, PAD_B, 
-		PAD_SELECT, PAD_START, 
-		PAD_PAUSE_EMU, PAD_LOAD_STATE, PAD_SAVE_STATE, 
-		PAD_BUTTONS_NUM };
+#include "types.h"
 
+// a pad's buttons packed in a byte, in the order its shift register hands them out
+#define PAD_A		0x01
+#define PAD_B		0x02
+#define PAD_SELECT	0x04
+#define PAD_START	0x08
+#define PAD_UP		0x10
+#define PAD_DOWN	0x20
+#define PAD_LEFT	0x40
+#define PAD_RIGHT	0x80
 
-void updateNesInput();
+#define NES_PADS 2
+
+
+// shows input_latency_cycles and input_host_poll_age every frame
+#define INPUT_LATENCY_TEST 0
+
+void startNesInputFrame();
+void latchNesInput();
+void markHostInputPoll();
+void measureInputLatency();
+void strobeNesInput(unsigned char data);
 void resetNesInput();
 
-extern unsigned char pad1[PAD_BUTTONS_NUM];
+// the buttons held, polled once per frame, and the ports' shift registers the game reads them through
+extern unsigned char pad_state[NES_PADS];
+extern unsigned char pad_shift[NES_PADS];
+extern unsigned char pad_strobe;
+// polled already since the last vblank
+extern bool pad_latched;
+
+// CPU cycles from the pad poll to the game's first read in the last frame, and from the host frame's poll
+extern int input_latency_cycles;
+extern int input_host_poll_age;
 
 #endif
@@ -0,0 +1,78 @@
+/*
+ * platform.h - what the emulator core needs from the machine it runs on
+ *
+ * The core (CPU, PPU, mappers, frame loop, snapshots, movies) only reaches the outside world through
+ * these. 3DO/platform.c implements them with the 3DO folios and CELs, host/platform.c headless for
+ * Linux builds, where the screen only lives in memory and the pads only come from movies.
+ */
+
+#ifndef LAMENES_PLATFORM_H
+#define LAMENES_PLATFORM_H
+
+#include "types.h"
+
+// The renderers build pixels in 32 bit words, first pixel in the high bits as the big endian ARM60 stores them.
+// Little endian hosts get the tables built the other way round instead, only pattern bytes read as words need a swap.
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define PLATFORM_LITTLE_ENDIAN 1
+#else
+#define PLATFORM_LITTLE_ENDIAN 0
+#endif
+
+#define BSWAP32(x) ((((x) >> 24) & 0xff) | (((x) >> 8) & 0xff00) | (((x) & 0xff00) << 8) | ((x) << 24))
+
+#if PLATFORM_LITTLE_ENDIAN
+// a word of 4 bytes, the first one in the high bits
+#define LOAD_BE32(p) BSWAP32(*(const uint32*)(p))
+// two 16 bit pixels in one word, in screen order
+#define PIXEL_PAIR16(first, second) (((uint32)(second) << 16) | (first))
+// two 8 bit pixels in 16 bits, in screen order
+#define PIXEL_PAIR8(first, second) (((second) << 8) | (first))
+#else
+#define LOAD_BE32(p) (*(const uint32*)(p))
+#define PIXEL_PAIR16(first, second) (((uint32)(first) << 16) | (second))
+#define PIXEL_PAIR8(first, second) (((first) << 8) | (second))
+#endif
+
+
+// memory, for what the core allocates once per game
+extern void *platform_alloc(int size);
+extern void platform_free(void *p);
+
+// milliseconds, only differences mean anything
+extern int platform_ticks();
+// microseconds for the profiler and the run-ahead cost, differences still right when it wraps
+extern uint32 platform_usec();
+
+// read only files, names relative to where the ROMs are
+typedef struct PlatformFile PlatformFile;
+
+extern PlatformFile *platform_file_open(char *name);
+extern int platform_file_size(PlatformFile *f);
+extern int platform_file_read(PlatformFile *f, void *dst, int size);
+extern void platform_file_close(PlatformFile *f);
+// returns false where files can't be written
+extern bool platform_file_write(char *name, const void *data, int size);
+
+// the buttons of NES pad 0 or 1 held right now, packed like nes_input.h PAD_ bits
+extern unsigned char platform_read_pad(int pad);
+
+// What the renderers draw into, a width * height NES screen with room for the fine scroll: both buffers
+// have pitch (at least width + 8) pixels per line and height + 8 lines. Line y of the picture starts
+// scrollRowX[y >> 3] & 7 pixels into its line.
+typedef struct {
+	uint16 *pixels;
+	uint8 *pixels8;
+	int pitch;
+	int width;
+	int height;
+} ScreenSurface;
+
+extern ScreenSurface screen;
+
+// fills screen in for a width * height NES screen
+extern bool platform_video_init(int width, int height);
+// shows the frame, rendered is false if the surface still holds the previous one
+extern void platform_video_present(bool rendered);
+
+#endif
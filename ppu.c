@@ -41,15 +41,71 @@
 #include "macros.h"
 #include "romloader.h"
 #include "memory.h"
+#include "state.h"
+#include "platform.h"
 
-// gfx cache -> [hor][ver]
-unsigned char sprcache[256+8][240];
-unsigned char shouldCheckSprCache[240];
+// per scanline sprite buckets built by evaluate_sprites
+unsigned char sprite_eval_oam[SPRITE_MEMORY];
+unsigned char sprite_line_count[240];
+unsigned char sprite_line_list[240][64];
+int sprite_overflow_line = -1;
+int sprite_limit_enabled = 1;
+
+// where sprite 0 will hit the background this frame, -1 if it doesn't
+int sprite0_hit_line = -1;
+int sprite0_hit_x = -1;
 
 uint32 attribBitsTab[4];
 uint32 tilemix[256][256];
 uint32 xy_scroll_tab[2][64];
 uint32 palmap32[256];
+uint8 byte_reverse[256];
+// two packed palette index nibbles spread into two bytes, for the 8bpp indexed output
+uint16 nibble_pair_bytes[256];
+uint16 sprite_colors[16];
+
+#if TILE_KERNELS
+const tile_kernels *ppu_tile_kernels = NULL;
+bool tile_kernels_check = false;
+unsigned int tile_kernels_mismatches = 0;
+
+// the tiles a background line reads, and where the checked kernels draw
+#define KERNEL_TILES 33
+static uint16 kernelCheckRow[KERNEL_TILES * 8];
+#endif
+
+// sprite pixels of the line being drawn, indexed by sprite X (0x10 | palette index, SPRITE_PIXEL_BEHIND for background priority)
+#define SPRITE_LINE_WIDTH (256 + 8)
+static unsigned char sprite_line[SPRITE_LINE_WIDTH];
+static int sprite_line_start = SPRITE_LINE_WIDTH;
+static int sprite_line_end = 0;
+
+// nametable RAM, the console has 2KB and four screen cartridges add another 2KB
+unsigned char nametable_ram[0x1000];
+
+// $2000, $2400, $2800 and $2C00 point into nametable_ram depending on the mirroring
+unsigned char *nametable_slot[4];
+int mirroring_mode;
+
+// physical nametable_ram page of each slot
+int nametable_slot_page[4];
+
+// bumped once per $2007 burst into the 1KB page (pattern tables and nametable RAM)
+unsigned int vram_page_version[VRAM_PAGES];
+
+// CHR ROM currently copied in each 1KB pattern page, NULL once the page is written through $2007
+static const unsigned char *chr_page_src[VRAM_PAGE_NAMETABLE];
+
+// signature of the state each rendered line (or 8 line tile row) was last drawn with, and which lines differ from the previous frame
+static uint32 line_signature[240];
+static uint32 line_signature_epoch = 0;
+unsigned char line_changed[240];
+
+// palette RAM change tracking, so palmap32 is only rebuilt for the sub-palettes that changed
+unsigned int palette_version = 0;
+unsigned int palette_dirty = 0;
+// changes of each background sub-palette alone
+unsigned int bg_palette_version[4];
 
 // ppu control registers
 unsigned int ppu_control1 = 0x00;
@@ -94,6 +150,15 @@ void init_ppu()
 		}
 	}
 
+	for (i=0; i<256; ++i) {
+		int r = 0;
+		for (b=0; b<8; ++b) {
+			r |= ((i >> b) & 1) << (7 - b);
+		}
+		byte_reverse[i] = r;
+		nibble_pair_bytes[i] = PIXEL_PAIR8(i >> 4, i & 15);
+	}
+
 	for (j=0; j<2; ++j) {
 		for (i=0; i<64; ++i) {
 			xy_scroll_tab[j][i] = (j << 2) + (i & 2);
@@ -103,6 +168,74 @@ void init_ppu()
 	for (i=0; i<4; ++i) {
 		attribBitsTab[i] = 0x33333333 | (i << 2) | (i << 6) | (i << 10) | (i << 14) | (i << 18) | (i << 22) | (i << 26) | (i << 30);
 	}
+
+	// build the whole pair table on the first rendered line
+	palette_dirty = 15;
+
+	if (FS_MIRROR) {
+		mirroring_mode = MIRROR_FOUR_SCREEN;
+	} else if (MIRRORING == 0) {
+		mirroring_mode = MIRROR_HORIZONTAL;
+	} else {
+		mirroring_mode = MIRROR_VERTICAL;
+	}
+	ppu_set_mirroring(mirroring_mode);
+
+#if TILE_KERNELS
+	ppu_tile_kernels = tile_kernels_select();
+#endif
+}
+
+void ppu_load_chr(unsigned int address, const unsigned char *src, int size)
+{
+	// Mapper CHR ROM switches copy 1KB pages, pages already holding the same bank are left alone
+	// so games reselecting their banks every frame don't look like they changed graphics.
+	int page;
+
+	for (page = address >> 10; size > 0; ++page) {
+		if (chr_page_src[page] != src) {
+			memcpy(ppu_memory + (page << 10), src, 1024);
+			chr_page_src[page] = src;
+			vram_page_version[page]++;
+		}
+		src += 1024;
+		size -= 1024;
+	}
+}
+
+void ppu_set_mirroring(int mode)
+{
+	static const int slotPages[5][4] = {
+		{0, 0, 1, 1},	// horizontal
+		{0, 1, 0, 1},	// vertical
+		{0, 0, 0, 0},	// one screen, lower bank
+		{1, 1, 1, 1},	// one screen, upper bank
+		{0, 1, 2, 3}	// four screen
+	};
+	int i;
+
+	// four screen cartridges hardwire their layout, mapper mirroring control is ignored
+	if (FS_MIRROR) mode = MIRROR_FOUR_SCREEN;
+
+	mirroring_mode = mode;
+	for (i=0; i<4; ++i) {
+		nametable_slot_page[i] = slotPages[mode][i];
+		nametable_slot[i] = &nametable_ram[slotPages[mode][i] << 10];
+	}
+
+	// a $2007 burst might be pointing to the old layout
+	ppu_end_vram_burst();
+}
+
+unsigned char read_ppu_memory(unsigned int address)
+{
+	address &= 0x3fff;
+
+	// $3000-$3EFF mirrors the nametables
+	if (address >= 0x2000 && address < 0x3f00) {
+		return nametable_slot[(address >> 10) & 3][address & 0x3ff];
+	}
+	return ppu_memory[address];
 }
 
 int mw_ppu_0x2000 = 0;
@@ -114,189 +247,390 @@ int mw_ppu_0x2006 = 0;
 int mw_ppu_0x2007 = 0;
 int mw_ppu_0x4014 = 0;
 
-void write_ppu_memory(unsigned int address,unsigned char data)
-{	
-	int i;
+// $2007 burst, consecutive writes to the next address of the same 1KB page go straight through a cached pointer
+static unsigned char *vram_burst_dst;
+static unsigned int vram_burst_addr;
+static int vram_burst_step;
+static int vram_burst_left = 0;
 
-	if(address == 0x2000) {
-		ppu_addr_tmp = data;
+void ppu_end_vram_burst()
+{
+	vram_burst_left = 0;
+}
 
-		ppu_control1 = data;
+static void write_palette(unsigned int address, unsigned char data)
+{
+	// $3F20-$3FFF mirror $3F00-$3F1F
+	address = 0x3f00 | (address & 0x1f);
 
-		memory[address] = data;
+	if (ppu_memory[address] == data) return;
 
-		loopyT &= 0xf3ff; // ~(0000110000000000)
-		loopyT |= (data & 3) << 10; // (00000011)
-        if (DEBUG_MEM_FREQS) mw_ppu_0x2000++;
-		return;
-    }
+	ppu_memory[address] = data;
 
-	if(address == 0x2001) {
-		ppu_addr_tmp = data;
+	// $3F10/$3F14/$3F18/$3F1C are shared with the background entries
+	if ((address & 3) == 0) {
+		ppu_memory[address ^ 0x10] = data;
+		address &= ~0x10;
+	}
 
-		ppu_control2 = data;
-		memory[address] = data;
-        if (DEBUG_MEM_FREQS) mw_ppu_0x2001++;
-		return;
-    }
+	// only the background sub-palettes live in palmap32, sprites read ppu_memory directly
+	if (address < 0x3f10) {
+		palette_dirty |= 1 << ((address >> 2) & 3);
+		bg_palette_version[(address >> 2) & 3]++;
+	}
 
-	// sprite_memory address register
-	if(address == 0x2003) {
-		ppu_addr_tmp = data;
+	palette_version++;
+}
 
-		sprite_address = data;
-		memory[address] = data;
-        if (DEBUG_MEM_FREQS) mw_ppu_0x2003++;
+static void write_vram(unsigned char data)
+{
+	// Slow path of $2007, starts a new burst that lasts until the increment leaves this 1KB page.
+	// The page is marked dirty once here for the whole burst.
+	const unsigned int vram_addr = ppu_addr & 0x3fff;
+	const int step = increment_32 ? 32 : 1;
+	unsigned int end = (vram_addr | 0x3ff) + 1;
+	unsigned char *dst;
+	int page;
+
+	if (vram_addr >= 0x3f00) {
+		// palette writes are few and need their mirrors handled one by one
+		write_palette(vram_addr, data);
+		vram_burst_left = 0;
 		return;
 	}
 
-	// sprite_memory i/o register
-	if(address == 0x2004) {
-		ppu_addr_tmp = data;
+	if (vram_addr >= 0x2000) {
+		// nametables, mirrors are just other slots pointing to the same RAM
+		const int slot = (vram_addr >> 10) & 3;
+		dst = &nametable_slot[slot][vram_addr & 0x3ff];
+		page = VRAM_PAGE_NAMETABLE + nametable_slot_page[slot];
+		if (end > 0x3f00) end = 0x3f00;
+	} else {
+		dst = &ppu_memory[vram_addr];
+		page = vram_addr >> 10;
+	}
 
-		sprite_memory[sprite_address] = data;
-		sprite_address++;
-        if (DEBUG_MEM_FREQS) mw_ppu_0x2004++;
-		memory[address] = data;
-		return;
+	*dst = data;
+	vram_page_version[page]++;
+	if (page < VRAM_PAGE_NAMETABLE) {
+		chr_page_src[page] = NULL;
 	}
 
-	// vram address register #1 (scrolling)
-	if(address == 0x2005) {
-		ppu_addr_tmp = data;
-        if (DEBUG_MEM_FREQS) mw_ppu_0x2005++;
-		if(ppu_bgscr_f == 0x00) {
-			loopyT &= 0xFFE0; // (0000000000011111)
-			loopyT |= (data & 0xF8) >> 3; // (11111000)
-			loopyX = data & 0x07; // (00000111)
+	vram_burst_dst = dst + step;
+	vram_burst_step = step;
+	vram_burst_left = (end - 1 - vram_addr) / step;
+}
 
-			ppu_bgscr_f = 0x01;
+static void write_ppu_ctrl(unsigned char data)
+{
+	ppu_addr_tmp = data;
 
-			memory[address] = data;
+	ppu_control1 = data;
 
-			return;
-		}
+	memory[0x2000] = data;
 
-		if(ppu_bgscr_f == 0x01) {
-			loopyT &= 0xFC1F; // (0000001111100000)
-			loopyT |= (data & 0xF8) << 2; //(0111000000000000)
-			loopyT &= 0x8FFF; //(11111000)
-			loopyT |= (data & 0x07) << 12; // (00000111)
+	loopyT &= 0xf3ff; // ~(0000110000000000)
+	loopyT |= (data & 3) << 10; // (00000011)
 
-			ppu_bgscr_f = 0x00;
+	// the increment might have changed
+	vram_burst_left = 0;
+	if (DEBUG_MEM_FREQS) mw_ppu_0x2000++;
+}
 
-			memory[address] = data;
+static void select_palette_bank()
+{
+	int emphasis = color_emphasis;
+	uint16 *bank;
 
-			return;
-		}
+	// PAL consoles swap the red and green emphasis bits
+	if (systemType == SYSTEM_PAL) {
+		emphasis = (emphasis & EMPHASIS_BLUE) | ((emphasis & EMPHASIS_RED) << 1) | ((emphasis & EMPHASIS_GREEN) >> 1);
 	}
 
-	// vram address register #2
-	if(address == 0x2006) {
-		ppu_addr_tmp = data;
-        if (DEBUG_MEM_FREQS) mw_ppu_0x2006++;
-		// First write -> Store the high byte 6 bits and clear out the last two
-		if(ppu_addr_h == 0x00) {
-			ppu_addr = (data << 8);
+	bank = palette3DObanks[(emphasis << 1) | (monochrome_on ? 1 : 0)];
+	if (bank == palette3DO) return;
+
+	// every color changes, so it's handled like a write to all of palette RAM
+	palette3DO = bank;
+	palette_dirty = 15;
+	palette_version++;
+	bg_palette_version[0]++;
+	bg_palette_version[1]++;
+	bg_palette_version[2]++;
+	bg_palette_version[3]++;
+}
 
-			loopyT &= 0x00FF; // (0011111100000000)
-			loopyT |= (data & 0x3F) << 8; // (1100000000000000) (00111111)
+void ppu_save_state(PpuState *s)
+{
+	s->control1 = ppu_control1;
+	s->control2 = ppu_control2;
+	s->status = ppu_status;
+	s->status_tmp = ppu_status_tmp;
+	s->addr = ppu_addr;
+	s->addr_h = ppu_addr_h;
+	s->addr_tmp = ppu_addr_tmp;
+	s->bgscr_f = ppu_bgscr_f;
+	s->sprite_address = sprite_address;
+	s->loopyT = loopyT;
+	s->loopyV = loopyV;
+	s->loopyX = loopyX;
+	s->mirroring_mode = mirroring_mode;
+	memcpy(s->vram_page_version, vram_page_version, sizeof(vram_page_version));
+	s->palette_version = palette_version;
+
+	memcpy(s->loopyVtab, loopyVtab, sizeof(loopyVtab));
+}
 
-			ppu_addr_h = 0x01;
+void ppu_load_state(const PpuState *s, bool sameSession)
+{
+	// The memories are already back in place. Versions only go up, so a page still at the version it had
+	// in the snapshot holds the same bytes, and what was rendered or cached from it is still right.
+	// That keeps run-ahead, which loads a snapshot every frame, from redrawing the whole screen.
+	int i;
 
-			memory[address] = data;
+	ppu_control1 = s->control1;
+	ppu_control2 = s->control2;
+	ppu_status = s->status;
+	ppu_status_tmp = s->status_tmp;
+	ppu_addr = s->addr;
+	ppu_addr_h = s->addr_h;
+	ppu_addr_tmp = s->addr_tmp;
+	ppu_bgscr_f = s->bgscr_f;
+	sprite_address = s->sprite_address;
+	loopyT = s->loopyT;
+	loopyV = s->loopyV;
+	loopyX = s->loopyX;
+
+	memcpy(loopyVtab, s->loopyVtab, sizeof(loopyVtab));
+
+	ppu_set_mirroring(s->mirroring_mode);
+
+	for (i=0; i<VRAM_PAGES; ++i) {
+		if (!sameSession || vram_page_version[i] != s->vram_page_version[i]) {
+			vram_page_version[i]++;
+			// no longer what the mapper last copied in
+			if (i < VRAM_PAGE_NAMETABLE) {
+				chr_page_src[i] = NULL;
+			}
+		}
+	}
 
-			return;
+	select_palette_bank();
+	if (!sameSession || palette_version != s->palette_version) {
+		palette_dirty = 15;
+		palette_version++;
+		for (i=0; i<4; ++i) {
+			bg_palette_version[i]++;
 		}
+	}
+}
 
-		// Second write -> Store the low byte 8 bits
-		if(ppu_addr_h == 0x01) {
-			ppu_addr |= data;
+static void write_ppu_mask(unsigned char data)
+{
+	ppu_addr_tmp = data;
 
-			loopyT &= 0xFF00; // (0000000011111111)
-			loopyT |= data; // (11111111)
-			loopyV = loopyT; // v=t
+	ppu_control2 = data;
+	memory[0x2001] = data;
 
-			ppu_addr_h = 0x00;
+	select_palette_bank();
+	if (DEBUG_MEM_FREQS) mw_ppu_0x2001++;
+}
 
-			memory[address] = data;
+static void write_ppu_status(unsigned char data)
+{
+	// read only
+	memory[0x2002] = data;
+}
 
-			return;
-		}
+// sprite_memory address register
+static void write_oam_addr(unsigned char data)
+{
+	ppu_addr_tmp = data;
+
+	sprite_address = data;
+	memory[0x2003] = data;
+	if (DEBUG_MEM_FREQS) mw_ppu_0x2003++;
+}
+
+// sprite_memory i/o register
+static void write_oam_data(unsigned char data)
+{
+	ppu_addr_tmp = data;
+
+	sprite_memory[sprite_address] = data;
+	sprite_address = (sprite_address + 1) & 0xff;
+	if (DEBUG_MEM_FREQS) mw_ppu_0x2004++;
+	memory[0x2004] = data;
+}
+
+// vram address register #1 (scrolling)
+static void write_ppu_scroll(unsigned char data)
+{
+	ppu_addr_tmp = data;
+	if (DEBUG_MEM_FREQS) mw_ppu_0x2005++;
+	if(ppu_bgscr_f == 0x00) {
+		loopyT &= 0xFFE0; // (0000000000011111)
+		loopyT |= (data & 0xF8) >> 3; // (11111000)
+		loopyX = data & 0x07; // (00000111)
+
+		ppu_bgscr_f = 0x01;
+	} else {
+		loopyT &= 0xFC1F; // (0000001111100000)
+		loopyT |= (data & 0xF8) << 2; //(0111000000000000)
+		loopyT &= 0x8FFF; //(11111000)
+		loopyT |= (data & 0x07) << 12; // (00000111)
+
+		ppu_bgscr_f = 0x00;
 	}
+	memory[0x2005] = data;
+}
 
-	// vram i/o register
-	if(address == 0x2007) {
-		// if the vram_write_flag is on, vram writes should ignored 
-        if (DEBUG_MEM_FREQS) mw_ppu_0x2007++;
-		if(vram_write_flag)
-			return;
-
-		ppu_addr_tmp = data;
-
-		ppu_memory[ppu_addr] = data;
-
-		// nametable mirroring
-		if((ppu_addr > 0x1999) && (ppu_addr < 0x3000)) {
-			if(OS_MIRROR == 1) {
-				ppu_memory[ppu_addr + 0x400] = data;
-				ppu_memory[ppu_addr + 0x800] = data;
-				ppu_memory[ppu_addr + 0x1200] = data;
-			} /*else if(FS_MIRROR == 1) {
-				printf("FS_MIRRORING detected! do nothing\n");
-			} */else {
-				if(MIRRORING == 0) {
-					// horizontal
-					ppu_memory[ppu_addr + 0x400] = data;
-				} else {
-					// vertical
-					ppu_memory[ppu_addr + 0x800] = data;
-				}
-			}
-		}
+// vram address register #2
+static void write_ppu_addr(unsigned char data)
+{
+	ppu_addr_tmp = data;
+	if (DEBUG_MEM_FREQS) mw_ppu_0x2006++;
+	// First write -> Store the high byte 6 bits and clear out the last two
+	if(ppu_addr_h == 0x00) {
+		ppu_addr = (data << 8);
 
-		// palette mirror
-		if(ppu_addr == 0x3f10) {
-			ppu_memory[0x3f00] = data;
-		}
+		loopyT &= 0x00FF; // (0011111100000000)
+		loopyT |= (data & 0x3F) << 8; // (1100000000000000) (00111111)
+
+		ppu_addr_h = 0x01;
+	} else {
+		// Second write -> Store the low byte 8 bits
+		ppu_addr |= data;
 
-		ppu_addr_tmp = ppu_addr;
+		loopyT &= 0xFF00; // (0000000011111111)
+		loopyT |= data; // (11111111)
+		loopyV = loopyT; // v=t
 
-		if(!increment_32) {
-			ppu_addr++;
-		} else {
-			ppu_addr += 0x20;
-		}
-		memory[address] = data;
+		ppu_addr_h = 0x00;
+	}
+	memory[0x2006] = data;
+}
+
+// vram i/o register
+static void write_ppu_data(unsigned char data)
+{
+	// if the vram_write_flag is on, vram writes should ignored 
+	if (DEBUG_MEM_FREQS) mw_ppu_0x2007++;
+	if(vram_write_flag)
 		return;
+
+	// reads in between are still exact, the data is always stored right away
+	if (ppu_addr == vram_burst_addr && vram_burst_left > 0) {
+		*vram_burst_dst = data;
+		vram_burst_dst += vram_burst_step;
+		vram_burst_left--;
+	} else {
+		write_vram(data);
 	}
 
-	// transfer 256 bytes of memory into sprite_memory
-    if(address == 0x4014) {
-		for(i = 0; i < 256; i++) {
-			sprite_memory[i] = memory[0x100 * data + i];
-		}
-        if (DEBUG_MEM_FREQS) mw_ppu_0x4014++;
+	ppu_addr_tmp = ppu_addr;
+
+	if(!increment_32) {
+		ppu_addr++;
+	} else {
+		ppu_addr += 0x20;
 	}
+	vram_burst_addr = ppu_addr;
 
-	return;
+	memory[0x2007] = data;
+}
+
+static void (* const ppu_register_write[8])(unsigned char data) = {
+	write_ppu_ctrl, write_ppu_mask, write_ppu_status, write_oam_addr,
+	write_oam_data, write_ppu_scroll, write_ppu_addr, write_ppu_data
+};
+
+void write_ppu_register(unsigned int reg, unsigned char data)
+{
+	// $2000-$3FFF are 8 registers mirrored every 8 bytes, the caller masks the address
+	// lines already started are rendered with the old register values
+	catch_up_rendering();
+	ppu_register_write[reg](data);
+}
+
+// transfer 256 bytes of memory into sprite_memory
+void ppu_sprite_dma(unsigned char data)
+{
+	memcpy(sprite_memory, &memory[data << 8], SPRITE_MEMORY);
+	if (DEBUG_MEM_FREQS) mw_ppu_0x4014++;
+}
+
+static uint32 palmapColor(int index)
+{
+	// color 0 of every sub-palette is transparent, the renderer relies on BIT_16 for sprite priority
+	if ((index & 3) == 0) return palette3DO[ppu_memory[0x3f00 + index]];
+	return palette3DO[ppu_memory[0x3f00 + index]] | BIT_16;
 }
 
 void updatePalmap32()
 {
-	// It's possible colors will break in some games if we don't do this every scanline or char line
-	// I can optimize it or detect if those palette entries change by the CPU at a specific line in the future and only then do this 256 values copy.
-	// Right now I do it once per frame and super mario doesn't break at least
-	int i, j, n = 0;
-	for (j=0; j<16; ++j) {
-		int bit16j = BIT_16;
-		if ((j & 3) == 0) bit16j = 0;
-		for (i=0; i<16; ++i) {
-			int bit16i = BIT_16;
-			if ((i & 3) == 0) bit16i = 0;
-			palmap32[n++] = ((palette3DO[ppu_memory[0x3f00 + j]] | bit16j) << 16) | palette3DO[ppu_memory[0x3f00 + i]] | bit16i;
+	// Called before every rendered line (or char line), it's a no-op unless the CPU touched the background palette since.
+	// Each entry pairs two 4bit indices (2 attribute bits + 2 color bits), so a sub-palette owns 4 rows and 4 columns of the table.
+	int i, j, s;
+	uint32 colors[16];
+
+	if (!palette_dirty) return;
+
+	for (i=0; i<16; ++i) {
+		colors[i] = palmapColor(i);
+	}
+
+	for (s=0; s<4; ++s) {
+		const int first = s << 2;
+
+		if (!(palette_dirty & (1 << s))) continue;
+
+		for (j=first; j<first+4; ++j) {
+			uint32 *dst = &palmap32[j << 4];
+			for (i=0; i<16; ++i) {
+				dst[i] = PIXEL_PAIR16(colors[j], colors[i]);
+			}
+		}
+
+		for (j=0; j<16; ++j) {
+			uint32 *dst = &palmap32[j << 4];
+			for (i=first; i<first+4; ++i) {
+				dst[i] = PIXEL_PAIR16(colors[j], colors[i]);
+			}
 		}
 	}
+
+	palette_dirty = 0;
+}
+
+static uint32 loopy_next_line(uint32 v)
+{
+	// subtile y_offset == 7
+	if((v & 0x7000) == 0x7000) {
+		// subtile y_offset = 0
+		v &= 0x8fff;
+
+		// nametable line == 29
+		if((v & 0x03e0) == 0x03a0) {
+			// switch nametables (bit 11)
+			v ^= 0x0800;
+
+			// name table line = 0
+			v &= 0xfc1f;
+		} else {
+			// nametable line == 31
+			if((v & 0x03e0) == 0x03e0) {
+				// name table line = 0
+				v &= 0xfc1f;
+			} else {
+				v += 0x0020;
+			}
+		}
+	} else {
+		// next subtile y_offset
+		v += 0x1000;
+	}
+	return v;
 }
 
 void update_scanline_values(int scanline, int times)
@@ -311,409 +645,781 @@ void update_scanline_values(int scanline, int times)
 
 		loopyVtab[y] = loopyV;
 
-		// subtile y_offset == 7
-		if((loopyV & 0x7000) == 0x7000) {
-			// subtile y_offset = 0
-			loopyV &= 0x8fff;
+		loopyV = loopy_next_line(loopyV);
+	}
+}
 
-			// nametable line == 29
-			if((loopyV & 0x03e0) == 0x03a0) {
-				// switch nametables (bit 11)
-				loopyV ^= 0x0800;
+static uint32 mix_signature(uint32 sig, uint32 value)
+{
+	// FNV-1a style, one multiply per 32bit value
+	return (sig ^ value) * 16777619U;
+}
 
-				// name table line = 0
-				loopyV &= 0xfc1f;
-			} else {
-				// nametable line == 31
-				if((loopyV & 0x03e0) == 0x03e0) {
-					// name table line = 0
-					loopyV &= 0xfc1f;
-				} else {
-						loopyV += 0x0020;
-				}
-			}
+void invalidate_line_signatures()
+{
+	line_signature_epoch++;
+}
+
+static uint32 mix_pattern_pages(uint32 sig, int first, int count)
+{
+	// A page holding a CHR ROM bank is that bank wherever it was copied from, so switching banks away and back
+	// (a status bar every frame) leaves the lines drawn from it unchanged. Pages written through $2007 go by their version.
+	int page;
+
+	for (page=first; page<first+count; ++page) {
+		if (chr_page_src[page]) {
+			sig = mix_signature(sig, (uint32)(chr_page_src[page] - romcache));
 		} else {
-			// next subtile y_offset
-			loopyV += 0x1000;
+			sig = mix_signature(sig, 0x80000000 | vram_page_version[page]);
 		}
 	}
+	return sig;
 }
 
-void render_background(int scanline)
+int lines_need_render(int scanline, int lines)
 {
-	int i, tile_count;
+	// Signature of everything the background and sprites of these lines are made from: control registers, scroll,
+	// the nametable pages and pattern tables read, the palette (unless the output is indexed) and the sprites in the line buckets.
+	// Lines with the same signature as the previous rendered frame still have the right pixels in the screen buffer.
+	uint32 sig = mix_signature(2166136261U, line_signature_epoch);
+	int i, n, changed;
+	int spritePagesMixed = 0;
+
+	sig = mix_signature(sig, renderer | (outputMode << 2) | (ppu_control1 << 8) | (ppu_control2 << 16) | (sprite_limit_enabled << 24));
+	sig = mix_signature(sig, scrollRowX[(scanline >> 3) & 31]);
+	// only the pattern pages the lines read, the background table and the sprite one(s) if there are sprites
+	if (background_on) {
+		sig = mix_pattern_pages(sig, background_addr_hi ? 4 : 0, 4);
+	}
+	if (outputMode == OUTPUT_DIRECT_16BPP) {
+		sig = mix_signature(sig, palette_version);
+	}
 
-	int nt_addr;
-	int at_addr;
+	for (i=0; i<lines; ++i) {
+		const int line = scanline + i;
+		const uint32 v = loopyVtab[line];
+		const int page = nametable_slot_page[(v >> 10) & 3];
+		const int next_page = nametable_slot_page[((v >> 10) & 3) ^ 1];
+		const int count = sprite_line_count[line];
+
+		sig = mix_signature(sig, v);
+		sig = mix_signature(sig, (page << 30) ^ vram_page_version[VRAM_PAGE_NAMETABLE + page]);
+		sig = mix_signature(sig, (next_page << 30) ^ vram_page_version[VRAM_PAGE_NAMETABLE + next_page]);
+		sig = mix_signature(sig, count);
+
+		if (count > 0 && !spritePagesMixed) {
+			sig = sprite_16 ? mix_pattern_pages(sig, 0, 8) : mix_pattern_pages(sig, sprite_addr_hi ? 4 : 0, 4);
+			spritePagesMixed = 1;
+		}
 
-	int x_scroll;
-	int y_scroll;
-	uint32 *xy_scroll_pair;
+		for (n=0; n<count; ++n) {
+			const unsigned char *oam = &sprite_eval_oam[sprite_line_list[line][n] << 2];
+			sig = mix_signature(sig, (oam[0] << 24) | (oam[1] << 16) | (oam[2] << 8) | oam[3]);
+		}
+	}
 
-	int pt_addr;
-	int pt_addr_off;
-	uint16 *dst;
-	
-	const uint32 loopyVval = loopyVtab[scanline];
-	const uint32 *palSrc32 = (uint32*)palmap32;
-	const uint32 screenCelWidthInDwords = screenCel->ccb_Width >> 1;
+	changed = (sig != line_signature[scanline]);
+	line_signature[scanline] = sig;
 
-	// We may not need this. Either a lame hack to position screen or it actually does have to do with different NES timings
-	//if (systemType == SYSTEM_NTSC) scanline -= 8;
-	
-	dst = (uint16*)screenCel->ccb_SourcePtr + scanline * screenCel->ccb_Width;
-
-	x_scroll = (loopyVval & 0x1f);
-	y_scroll = (loopyVval & 0x03e0) >> 5;
-
-	nt_addr = 0x2000 + (loopyVval & 0x0fff);
-	at_addr = 0x2000 + (loopyVval & 0x0c00) + 0x03c0 + ((y_scroll & 0xfffc) << 1);
-	pt_addr_off = ((loopyVval & 0x7000) >> 12);
-
-	xy_scroll_pair = (uint32*)&xy_scroll_tab[(y_scroll >> 1) & 1][x_scroll];
-
-
-	if (renderer == RENDERER_PER_LINE) {
-		for(tile_count = 0; tile_count < 33; tile_count++)
-		{
-			const int at_addr_off = at_addr + (x_scroll >> 2);
-			const int attribs = (ppu_memory[at_addr_off] >> *xy_scroll_pair++) & 3;
-			const uint32 *tilemixAttribOffset = (uint32*)tilemix;
-			const uint32 attribBits = attribBitsTab[attribs];
-
-			pt_addr = (ppu_memory[nt_addr] << 4) + pt_addr_off;
-			// check if the pattern address needs to be high
-			if(background_addr_hi)
-				pt_addr+=0x1000;
-
-			{
-				const uint32 p1 = ppu_memory[pt_addr];
-				const uint32 p2 = ppu_memory[pt_addr + 8];
-				const uint32 tilemixNibbles = *(tilemixAttribOffset + (p2 << 8) + p1) & attribBits;
-
-				uint32 *dst32 = (uint32*)dst;
-				*dst32 = palSrc32[tilemixNibbles >> 24];
-				*(dst32+1) = palSrc32[(tilemixNibbles >> 16) & 255];
-				*(dst32+2) = palSrc32[(tilemixNibbles >> 8) & 255];
-				*(dst32+3) = palSrc32[tilemixNibbles & 255];
-				dst += 8;
-			}
+	for (i=0; i<lines; ++i) {
+		line_changed[scanline + i] = changed;
+	}
 
-			nt_addr++;
-			x_scroll = (x_scroll + 1) & 0x1F;
-			// check if we crossed a nametable
-			if(x_scroll == 0) {
-				// switch name/attrib tables
-				nt_addr ^= 0x0400;
-				at_addr ^= 0x0400;
-				nt_addr -= 0x0020;
-			}
+	return changed;
+}
+
+static void clip_left_column(int scanline, int lines)
+{
+	const uint16 backdrop = palette3DO[ppu_memory[0x3f00]];
+	const uint32 width = screen.pitch;
+	const uint32 offset = scanline * width + scrollRowX[(scanline >> 3) & 31];
+	uint16 *dst = screen.pixels + offset;
+	uint8 *dst8 = screen.pixels8 + offset;
+	int i;
+
+	for (i=0; i<lines; ++i) {
+		if (outputMode == OUTPUT_INDEXED_8BPP) {
+			// index 0 is the backdrop in every row PLUT
+			memset(dst8, 0, 8);
+			dst8 += width;
+		} else {
+			dst[0] = dst[1] = dst[2] = dst[3] = backdrop;
+			dst[4] = dst[5] = dst[6] = dst[7] = backdrop;
+			dst += width;
 		}
-	} else if (renderer == RENDERER_PER_TILE) {
-		for(tile_count = 0; tile_count < 33; tile_count++)
-		{
-			const int at_addr_off = at_addr + (x_scroll >> 2);
-			const int attribs = (ppu_memory[at_addr_off] >> *xy_scroll_pair++) & 3;
-			const uint32 *tilemixAttribOffset = (uint32*)tilemix;
-			const uint32 attribBits = attribBitsTab[attribs];
-
-			pt_addr = (ppu_memory[nt_addr] << 4) + pt_addr_off;
-			// check if the pattern address needs to be high
-			if(background_addr_hi)
-				pt_addr+=0x1000;
-
-			{
-				uint32 *bp = (uint32*)&ppu_memory[pt_addr];
-				uint32 *dstc32 = (uint32*)dst;
-
-				for (i=0; i<2; ++i) {
-					const uint32 up2 = *(bp+2);
-					const uint32 up1 = *bp++;
-
-					{
-						const uint32 tilemixNibbles = *(tilemixAttribOffset + ((up2 >> 16) & 0xFF00) + (up1 >> 24)) & attribBits;
-						*dstc32 = palSrc32[tilemixNibbles >> 24];
-						*(dstc32+1) = palSrc32[(tilemixNibbles >> 16) & 255];
-						*(dstc32+2) = palSrc32[(tilemixNibbles >> 8) & 255];
-						*(dstc32+3) = palSrc32[tilemixNibbles & 255];
-						dstc32 += screenCelWidthInDwords;
-					}
-
-					{
-						const uint32 tilemixNibbles = *(tilemixAttribOffset + ((up2 >> 8) & 0xFF00) + ((up1 >> 16) & 0xFF)) & attribBits;
-						*dstc32 = palSrc32[tilemixNibbles >> 24];
-						*(dstc32+1) = palSrc32[(tilemixNibbles >> 16) & 255];
-						*(dstc32+2) = palSrc32[(tilemixNibbles >> 8) & 255];
-						*(dstc32+3) = palSrc32[tilemixNibbles & 255];
-						dstc32 += screenCelWidthInDwords;
-					}
-
-					{
-						const uint32 tilemixNibbles = *(tilemixAttribOffset + (up2 & 0xFF00) + ((up1 >> 8) & 0xFF)) & attribBits;
-						*dstc32 = palSrc32[tilemixNibbles >> 24];
-						*(dstc32+1) = palSrc32[(tilemixNibbles >> 16) & 255];
-						*(dstc32+2) = palSrc32[(tilemixNibbles >> 8) & 255];
-						*(dstc32+3) = palSrc32[tilemixNibbles & 255];
-						dstc32 += screenCelWidthInDwords;
-					}
-
-					{
-						const uint32 tilemixNibbles = *(tilemixAttribOffset + ((up2 << 8) & 0xFF00) + (up1 & 0xFF)) & attribBits;
-						*dstc32 = palSrc32[tilemixNibbles >> 24];
-						*(dstc32+1) = palSrc32[(tilemixNibbles >> 16) & 255];
-						*(dstc32+2) = palSrc32[(tilemixNibbles >> 8) & 255];
-						*(dstc32+3) = palSrc32[tilemixNibbles & 255];
-						dstc32 += screenCelWidthInDwords;
-					}
-				}
-				dst += 8;
-			}
+	}
+}
 
-			nt_addr++;
-			x_scroll = (x_scroll + 1) & 0x1F;
-			// check if we crossed a nametable
-			if(x_scroll == 0) {
-				// switch name/attrib tables
-				nt_addr ^= 0x0400;
-				at_addr ^= 0x0400;
-				nt_addr -= 0x0020;
-			}
+// Pre-colored tile cache: 8x8 tiles in the output pixel format, at most one entry per (pattern tile, sub-palette).
+// An entry stays valid while its pattern page and its sub-palette keep their versions, least recently used entries are reused first.
+typedef struct {
+	uint32 *pixels;
+	unsigned int chr_version;
+	unsigned int palette_version;
+	short key;
+	short prev, next;
+} TileCacheEntry;
+
+int tile_cache_enabled = TILE_CACHE_ENABLED;
+int tile_cache_budget = TILE_CACHE_BUDGET;
+unsigned int tile_cache_hits = 0;
+unsigned int tile_cache_misses = 0;
+
+static TileCacheEntry *tile_cache = NULL;
+static uint32 *tile_cache_pool = NULL;
+static int tile_cache_capacity = 0;
+static int tile_cache_used = 0;
+static int tile_cache_words = 0;
+static int tile_cache_format = -1;
+// (tile << 2) | sub-palette -> entry, -1 if not cached
+static short tile_cache_slot[512 * 4];
+// most recently used first
+static short tile_cache_head = -1;
+static short tile_cache_tail = -1;
+
+int tile_cache_reset()
+{
+	// sized for the current output format within the memory budget, returns 0 if there's no room for it
+	int i;
+
+	platform_free(tile_cache);
+	platform_free(tile_cache_pool);
+
+	tile_cache_format = outputMode;
+	tile_cache_words = (outputMode == OUTPUT_INDEXED_8BPP) ? 16 : 32;
+	tile_cache_capacity = (tile_cache_budget - (int)sizeof(tile_cache_slot)) / (tile_cache_words * 4 + (int)sizeof(TileCacheEntry));
+	if (tile_cache_capacity > 512 * 4) tile_cache_capacity = 512 * 4;
+	if (tile_cache_capacity < 0) tile_cache_capacity = 0;
+
+	tile_cache = (TileCacheEntry*)platform_alloc(tile_cache_capacity * sizeof(TileCacheEntry));
+	tile_cache_pool = (uint32*)platform_alloc(tile_cache_capacity * tile_cache_words * 4);
+	if (tile_cache_capacity == 0 || !tile_cache || !tile_cache_pool) {
+		platform_free(tile_cache);
+		platform_free(tile_cache_pool);
+		tile_cache = NULL;
+		tile_cache_pool = NULL;
+		tile_cache_capacity = 0;
+		tile_cache_enabled = 0;
+	}
+
+	for (i=0; i<512 * 4; ++i) {
+		tile_cache_slot[i] = -1;
+	}
+	tile_cache_used = 0;
+	tile_cache_head = tile_cache_tail = -1;
+	tile_cache_hits = tile_cache_misses = 0;
+
+	return tile_cache_enabled;
+}
+
+int tile_cache_memory()
+{
+	return tile_cache_capacity * (tile_cache_words * 4 + sizeof(TileCacheEntry)) + sizeof(tile_cache_slot);
+}
+
+static void tile_cache_unlink(int e)
+{
+	TileCacheEntry *entry = &tile_cache[e];
+
+	if (entry->prev >= 0) tile_cache[entry->prev].next = entry->next; else tile_cache_head = entry->next;
+	if (entry->next >= 0) tile_cache[entry->next].prev = entry->prev; else tile_cache_tail = entry->prev;
+}
+
+static void tile_cache_push_front(int e)
+{
+	TileCacheEntry *entry = &tile_cache[e];
+
+	entry->prev = -1;
+	entry->next = tile_cache_head;
+	if (tile_cache_head >= 0) tile_cache[tile_cache_head].prev = e; else tile_cache_tail = e;
+	tile_cache_head = e;
+}
+
+static void tile_cache_fill(uint32 *dst, int pt_addr, int attribs)
+{
+	const uint32 attribBits = attribBitsTab[attribs];
+	int row;
+
+	for (row=0; row<8; ++row) {
+		const uint32 nibbles = tilemix[ppu_memory[pt_addr + row + 8]][ppu_memory[pt_addr + row]] & attribBits;
+
+		if (tile_cache_format == OUTPUT_INDEXED_8BPP) {
+			*dst++ = PIXEL_PAIR16(nibble_pair_bytes[nibbles >> 24], nibble_pair_bytes[(nibbles >> 16) & 255]);
+			*dst++ = PIXEL_PAIR16(nibble_pair_bytes[(nibbles >> 8) & 255], nibble_pair_bytes[nibbles & 255]);
+		} else {
+			*dst++ = palmap32[nibbles >> 24];
+			*dst++ = palmap32[(nibbles >> 16) & 255];
+			*dst++ = palmap32[(nibbles >> 8) & 255];
+			*dst++ = palmap32[nibbles & 255];
 		}
 	}
 }
 
+static const uint32 *tile_cache_get(int pt_addr, int attribs)
+{
+	// pt_addr is the first byte of the tile, indexed tiles don't depend on the colors
+	const int key = ((pt_addr >> 4) << 2) | attribs;
+	const unsigned int chr_ver = vram_page_version[pt_addr >> 10];
+	const unsigned int pal_ver = (tile_cache_format == OUTPUT_INDEXED_8BPP) ? 0 : bg_palette_version[attribs];
+	int e = tile_cache_slot[key];
+	TileCacheEntry *entry;
+
+	if (e >= 0) {
+		entry = &tile_cache[e];
+		if (e != tile_cache_head) {
+			tile_cache_unlink(e);
+			tile_cache_push_front(e);
+		}
+		if (entry->chr_version == chr_ver && entry->palette_version == pal_ver) {
+			tile_cache_hits++;
+			return entry->pixels;
+		}
+		// same tile and sub-palette with new graphics or colors, refilled in place
+	} else {
+		if (tile_cache_used < tile_cache_capacity) {
+			e = tile_cache_used++;
+			tile_cache[e].pixels = tile_cache_pool + e * tile_cache_words;
+		} else {
+			e = tile_cache_tail;
+			tile_cache_slot[tile_cache[e].key] = -1;
+			tile_cache_unlink(e);
+		}
+		entry = &tile_cache[e];
+		entry->key = key;
+		tile_cache_slot[key] = e;
+		tile_cache_push_front(e);
+	}
 
-void render_sprite(int x, int y, int pattern_number, int attribs, int spr_nr)
+	tile_cache_misses++;
+	entry->chr_version = chr_ver;
+	entry->palette_version = pal_ver;
+	tile_cache_fill(entry->pixels, pt_addr, attribs);
+
+	return entry->pixels;
+}
+
+// one background renderer per line/tile row mode, pattern table, output format and tile cache use, generated from render_bg.h
+#define BG_FUNC render_bg_line_lo_16
+#define BG_PER_TILE 0
+#define BG_PATTERN_HI 0
+#define BG_INDEXED 0
+#define BG_CACHED 0
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_line_hi_16
+#define BG_PER_TILE 0
+#define BG_PATTERN_HI 1
+#define BG_INDEXED 0
+#define BG_CACHED 0
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_tile_lo_16
+#define BG_PER_TILE 1
+#define BG_PATTERN_HI 0
+#define BG_INDEXED 0
+#define BG_CACHED 0
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_tile_hi_16
+#define BG_PER_TILE 1
+#define BG_PATTERN_HI 1
+#define BG_INDEXED 0
+#define BG_CACHED 0
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_line_lo_8
+#define BG_PER_TILE 0
+#define BG_PATTERN_HI 0
+#define BG_INDEXED 1
+#define BG_CACHED 0
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_line_hi_8
+#define BG_PER_TILE 0
+#define BG_PATTERN_HI 1
+#define BG_INDEXED 1
+#define BG_CACHED 0
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_tile_lo_8
+#define BG_PER_TILE 1
+#define BG_PATTERN_HI 0
+#define BG_INDEXED 1
+#define BG_CACHED 0
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_tile_hi_8
+#define BG_PER_TILE 1
+#define BG_PATTERN_HI 1
+#define BG_INDEXED 1
+#define BG_CACHED 0
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_cached_line_lo_16
+#define BG_PER_TILE 0
+#define BG_PATTERN_HI 0
+#define BG_INDEXED 0
+#define BG_CACHED 1
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_cached_line_hi_16
+#define BG_PER_TILE 0
+#define BG_PATTERN_HI 1
+#define BG_INDEXED 0
+#define BG_CACHED 1
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_cached_tile_lo_16
+#define BG_PER_TILE 1
+#define BG_PATTERN_HI 0
+#define BG_INDEXED 0
+#define BG_CACHED 1
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_cached_tile_hi_16
+#define BG_PER_TILE 1
+#define BG_PATTERN_HI 1
+#define BG_INDEXED 0
+#define BG_CACHED 1
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_cached_line_lo_8
+#define BG_PER_TILE 0
+#define BG_PATTERN_HI 0
+#define BG_INDEXED 1
+#define BG_CACHED 1
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_cached_line_hi_8
+#define BG_PER_TILE 0
+#define BG_PATTERN_HI 1
+#define BG_INDEXED 1
+#define BG_CACHED 1
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_cached_tile_lo_8
+#define BG_PER_TILE 1
+#define BG_PATTERN_HI 0
+#define BG_INDEXED 1
+#define BG_CACHED 1
+#include "render_bg.h"
+
+#define BG_FUNC render_bg_cached_tile_hi_8
+#define BG_PER_TILE 1
+#define BG_PATTERN_HI 1
+#define BG_INDEXED 1
+#define BG_CACHED 1
+#include "render_bg.h"
+
+// [cached][indexed][per tile][pattern table hi]
+static void (* const background_renderers[2][2][2][2])(int scanline, uint8 *dst) = {
+	{
+		{ { render_bg_line_lo_16, render_bg_line_hi_16 }, { render_bg_tile_lo_16, render_bg_tile_hi_16 } },
+		{ { render_bg_line_lo_8, render_bg_line_hi_8 }, { render_bg_tile_lo_8, render_bg_tile_hi_8 } }
+	},
+	{
+		{ { render_bg_cached_line_lo_16, render_bg_cached_line_hi_16 }, { render_bg_cached_tile_lo_16, render_bg_cached_tile_hi_16 } },
+		{ { render_bg_cached_line_lo_8, render_bg_cached_line_hi_8 }, { render_bg_cached_tile_lo_8, render_bg_cached_tile_hi_8 } }
+	}
+};
+
+#if TILE_KERNELS
+static void render_background_kernels(int scanline, int lines, uint16 *dst)
 {
-	int disp_spr_back;
-	int flip_spr_hor;
-	int flip_spr_ver;
+	// The tiles and attributes the render_bg.h template reads, in two runs across the nametables the same way,
+	// then each row of pattern bytes expanded by the kernel.
+	const uint32 v = loopyVtab[scanline];
+	const int y_scroll = (v & 0x03e0) >> 5;
+	const int at_addr = 0x03c0 + ((y_scroll & 0xfffc) << 1);
+	const int pt_base = ((v & 0x7000) >> 12) + (background_addr_hi ? 0x1000 : 0);
+	const unsigned char *nt = nametable_slot[(v >> 10) & 3];
+	int nt_addr = v & 0x03ff;
+	int x_scroll = v & 0x1f;
+	int pt_addr[KERNEL_TILES];
+	unsigned char attr[KERNEL_TILES];
+	unsigned char plane0[KERNEL_TILES];
+	unsigned char plane1[KERNEL_TILES];
+	unsigned short pal[16];
+	int t, row;
+
+	// color 0 of every sub-palette is the backdrop, tilemix leaves the attribute out of those pixels
+	for (t=0; t<16; ++t) {
+		pal[t] = palmapColor((t & 3) ? t : 0);
+	}
 
-	int i;
-	int j;
+	for (t=0; t<KERNEL_TILES; ++t) {
+		if (x_scroll == 32) {
+			nt = nametable_slot[((v >> 10) & 3) ^ 1];
+			nt_addr -= 0x0020;
+			x_scroll = 0;
+		}
+		attr[t] = (nt[at_addr + (x_scroll >> 2)] >> xy_scroll_tab[(y_scroll >> 1) & 1][x_scroll]) & 3;
+		pt_addr[t] = (nt[nt_addr] << 4) + pt_base;
+		nt_addr++;
+		x_scroll++;
+	}
 
-	int spr_start;
-	int sprite_pattern_table;
-	
-	unsigned char sprite[8*16];
-
-	unsigned char *spritePtr;
-	uint16 *dst;
-	const int attribsAdd = (attribs & 0x03) << 0x02;
-	
-	if (!sprite_on) return;
+	for (row=0; row<lines; ++row) {
+		uint16 *line = dst + row * screen.pitch;
+		uint16 *out = tile_kernels_check ? kernelCheckRow : line;
+
+		for (t=0; t<KERNEL_TILES; ++t) {
+			plane0[t] = ppu_memory[pt_addr[t] + row];
+			plane1[t] = ppu_memory[pt_addr[t] + 8 + row];
+		}
+		ppu_tile_kernels->bg_row(out, plane0, plane1, attr, KERNEL_TILES, pal);
+
+		// the line already drawn with the tables
+		if (tile_kernels_check && memcmp(out, line, sizeof(kernelCheckRow)) != 0) {
+			tile_kernels_mismatches++;
+		}
+	}
+}
+#endif
+
+void render_background(int scanline)
+{
+	// the modes are picked once per line (or tile row), the tile loops have no branches left
+	const int indexed = (outputMode == OUTPUT_INDEXED_8BPP);
+	const int per_tile = (renderer == RENDERER_PER_TILE);
+	// the per tile renderer can only copy whole cached tiles when the rows start at the top of the tiles
+	int cached = tile_cache_enabled && !(per_tile && (loopyVtab[scanline] & 0x7000));
+	uint8 *dst;
 
-	disp_spr_back = attribs & 0x20;
-	flip_spr_hor = attribs & 0x40;
-	flip_spr_ver = attribs & 0x80;
+	// We may not need this. Either a lame hack to position screen or it actually does have to do with different NES timings
+	//if (systemType == SYSTEM_NTSC) scanline -= 8;
 
-	if(!sprite_addr_hi) {
-		sprite_pattern_table=0x0000;
+	// indexed output stores 1 byte per pixel instead of 2, the colors are only applied by the row PLUT
+	if (indexed) {
+		dst = screen.pixels8 + scanline * screen.pitch;
 	} else {
-		sprite_pattern_table=0x1000;
+		dst = (uint8*)(screen.pixels + scanline * screen.pitch);
+	}
+
+	if (cached && tile_cache_format != outputMode) {
+		cached = tile_cache_reset();
 	}
 
-	// - pattern_number * 16
-	spr_start = sprite_pattern_table + ((pattern_number << 3) << 1);
+#if TILE_KERNELS
+	if (ppu_tile_kernels && !indexed && !cached) {
+		const int lines = per_tile ? 8 : 1;
 
-	if (spr_nr==0) {
-		int i;
-		int sprHeight = 8;
-		if (sprite_16) sprHeight = 16;
-		for (i=0; i<sprHeight; ++i) {
-			const uint32 yi = y + i;
-			if (yi < NES_screen_height)
-				shouldCheckSprCache[yi] = 1;
+		if (tile_kernels_check) {
+			background_renderers[0][0][per_tile][background_addr_hi ? 1 : 0](scanline, dst);
 		}
+		render_background_kernels(scanline, lines, (uint16*)dst);
+	} else {
+		background_renderers[cached][indexed][per_tile][background_addr_hi ? 1 : 0](scanline, dst);
+	}
+#else
+	background_renderers[cached][indexed][per_tile][background_addr_hi ? 1 : 0](scanline, dst);
+#endif
+
+	// left 8 pixels hidden, filled with the backdrop so sprites behind the background still show there
+	if (!background_clipping_off) {
+		clip_left_column(scanline, renderer == RENDERER_PER_TILE ? 8 : 1);
 	}
+}
+
+static uint32 sprite_row_pixels(int row_addr, int flip_hor, uint32 attribBits)
+{
+	// same plane merge as the background tiles, horizontal flip just mirrors both planes first
+	uint32 p1 = ppu_memory[row_addr];
+	uint32 p2 = ppu_memory[row_addr + 8];
+
+	if (flip_hor) {
+		p1 = byte_reverse[p1];
+		p2 = byte_reverse[p2];
+	}
+
+	return tilemix[p2][p1] & attribBits;
+}
+
+static void render_sprite_line(int line, int spr_nr)
+{
+	const unsigned char *oam = &sprite_eval_oam[spr_nr << 2];
+	const int y = oam[0];
+	const int pattern_number = oam[1];
+	const int attribs = oam[2];
+
+	const int flip_spr_hor = attribs & 0x40;
+	const int flip_spr_ver = attribs & 0x80;
+	const int priority = (attribs & 0x20) ? SPRITE_PIXEL_BEHIND : 0;
+
+	unsigned char *dst = &sprite_line[oam[3]];
 
-	dst = (uint16*)screenCel->ccb_SourcePtr + y * screenCel->ccb_Width;
+	int i;
+	int row = line - y;
+	int spr_start;
+	uint32 pixels;
 
 	if(!sprite_16) {
-		int spriteVal;
-
-		// 8 x 8 sprites
-		// fetch bits
-		spritePtr = (unsigned char*)sprite;
-		if((!flip_spr_hor) && (!flip_spr_ver)) {
-			for(j = 0; j < 8; j++) {
-				const unsigned char p1 = ppu_memory[spr_start + j];
-				const unsigned char p2 = ppu_memory[spr_start + 8 + j];
-				spriteVal = ((p2 >> 6) & 2) | ((p1 >> 7) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 5) & 2) | ((p1 >> 6) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 4) & 2) | ((p1 >> 5) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 3) & 2) | ((p1 >> 4) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 2) & 2) | ((p1 >> 3) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 1) & 2) | ((p1 >> 2) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 0) & 2) | ((p1 >> 1) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 << 1) & 2) | ((p1 >> 0) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-			}
-		} else if((flip_spr_hor) && (!flip_spr_ver)) {
-			for(j = 0; j < 8; j++) {
-				const unsigned char p1 = ppu_memory[spr_start + j];
-				const unsigned char p2 = ppu_memory[spr_start + 8 + j];
-				spriteVal = ((p2 << 1) & 2) | ((p1 >> 0) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 0) & 2) | ((p1 >> 1) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 1) & 2) | ((p1 >> 2) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 2) & 2) | ((p1 >> 3) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 3) & 2) | ((p1 >> 4) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 4) & 2) | ((p1 >> 5) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 5) & 2) | ((p1 >> 6) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 6) & 2) | ((p1 >> 7) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-			}
-		} else if((!flip_spr_hor) && (flip_spr_ver)) {
-			for(j = 7; j >= 0; j--) {
-				const unsigned char p1 = ppu_memory[spr_start + j];
-				const unsigned char p2 = ppu_memory[spr_start + 8 + j];
-				spriteVal = ((p2 >> 6) & 2) | ((p1 >> 7) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 5) & 2) | ((p1 >> 6) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 4) & 2) | ((p1 >> 5) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 3) & 2) | ((p1 >> 4) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 2) & 2) | ((p1 >> 3) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 1) & 2) | ((p1 >> 2) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 0) & 2) | ((p1 >> 1) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 << 1) & 2) | ((p1 >> 0) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-			}
-		} else if((flip_spr_hor) && (flip_spr_ver)) {
-			for(j = 7; j >= 0; j--) {
-				const unsigned char p1 = ppu_memory[spr_start + j];
-				const unsigned char p2 = ppu_memory[spr_start + 8 + j];
-				spriteVal = ((p2 << 1) & 2) | ((p1 >> 0) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 0) & 2) | ((p1 >> 1) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 1) & 2) | ((p1 >> 2) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 2) & 2) | ((p1 >> 3) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 3) & 2) | ((p1 >> 4) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 4) & 2) | ((p1 >> 5) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 5) & 2) | ((p1 >> 6) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-				spriteVal = ((p2 >> 6) & 2) | ((p1 >> 7) & 1); if (spriteVal!=0) spriteVal += attribsAdd; *spritePtr++ = spriteVal;
-			}
+		if (flip_spr_ver) row = 7 - row;
+		// - pattern_number * 16
+		spr_start = ((pattern_number << 3) << 1);
+		if(sprite_addr_hi)
+			spr_start += 0x1000;
+	} else {
+		// 8 x 16 sprites pick their pattern table from bit 0 and use an even/odd pair of tiles
+		if (flip_spr_ver) row = 15 - row;
+		spr_start = ((pattern_number & 1) << 12) + ((pattern_number & 0xfe) << 4);
+	}
+
+	// the bottom half of a 8x16 sprite is the next tile (16 bytes further)
+	pixels = sprite_row_pixels(spr_start + ((row & 8) << 1) + (row & 7), flip_spr_hor, attribBitsTab[attribs & 0x03]);
+
+	// left 8 pixels hidden
+	if (!sprite_clipping_off && oam[3] < 8) {
+		pixels &= 0xffffffff >> ((8 - oam[3]) << 2);
+	}
+
+	if (pixels == 0) return;
+
+	// sprites come front to back, a pixel already taken by an opaque one stays (with its priority, like the hardware)
+	for(i = 0; i < 8; i++) {
+		const uint32 value = (pixels >> (28 - (i << 2))) & 15;
+
+		if(value != 0 && dst[i] == 0) {
+			dst[i] = 0x10 | value | priority;
 		}
+	}
 
-		spritePtr = (unsigned char*)sprite;
-		for(j = 0; j < 8; j++) {
-			// account for 0-7 scroll X offset of background row
-			const int xp = x + scrollRowX[((y+j) >> 3) & 31];
-			unsigned char *sprcachePtr = (unsigned char*)&sprcache[y+j][xp];
-			unsigned short *bgPtr = dst + xp;
-
-			for(i = 0; i < 8; i++) {
-				// cache pixel for sprite zero detection
-				const unsigned char value = *spritePtr++;
-				if(spr_nr == 0)
-					*sprcachePtr++ = value;
-
-				if(value != 0) {
-					// sprite priority check
-					if(!disp_spr_back) {
-						*(bgPtr + i) = palette3DO[ppu_memory[0x3f10 + value]];
-					} else {
-						// draw the sprite pixel if the background pixel is transparent (0)
-						if((*(bgPtr + i) & BIT_16) == 0) {
-							*(bgPtr + i) = palette3DO[ppu_memory[0x3f10 + value]];
-						}
-					}
-				}
+	if (oam[3] < sprite_line_start) sprite_line_start = oam[3];
+	if (oam[3] + 8 > sprite_line_end) sprite_line_end = oam[3] + 8;
+}
+
+static void composite_sprite_line(int line)
+{
+	// Each sprite pixel is written to the screen once, over the background unless it's behind an opaque one.
+	// The sprite line is cleared on the way for the next line.
+	const int offset = line * screen.pitch + scrollRowX[(line >> 3) & 31];
+	unsigned char *spr = sprite_line;
+	int x;
+
+	if (outputMode == OUTPUT_INDEXED_8BPP) {
+		// sprite indices are 16-31, the background is transparent where its index is color 0 of a sub-palette
+		uint8 *dst8 = screen.pixels8 + offset;
+
+		for (x = sprite_line_start; x < sprite_line_end; x++) {
+			const int s = spr[x];
+			if (s == 0) continue;
+
+			if (!(s & SPRITE_PIXEL_BEHIND) || (dst8[x] & 3) == 0) {
+				dst8[x] = s & 0x1f;
 			}
-			dst += screenCel->ccb_Width;
+			spr[x] = 0;
 		}
 	} else {
-		// 8 x 16 sprites
-		// fetch bits
-		spritePtr = (unsigned char*)sprite;
-		if((!flip_spr_hor) && (!flip_spr_ver)) {
-			for(j = 0; j < 16; j++) {
-				for(i = 7; i >= 0; i--) {
-					int spriteVal = (((ppu_memory[spr_start + 8 + j] >> i) & 1) << 1) | ((ppu_memory[spr_start + j] >> i) & 1);
-					if (spriteVal!=0) spriteVal += attribsAdd;
-					*spritePtr++ = spriteVal;
-				}
-			}
-		} else if((flip_spr_hor) && (!flip_spr_ver)) {
-			for(j = 0; j < 16; j++) {
-				for(i = 0; i < 8; i++) {
-					int spriteVal = (((ppu_memory[spr_start + 8 + j] >> i) & 1) << 1) | ((ppu_memory[spr_start + j] >> i) & 1);
-					if (spriteVal!=0) spriteVal += attribsAdd;
-					*spritePtr++ = spriteVal;
-				}
+		uint16 *dst = screen.pixels + offset;
+#if TILE_KERNELS
+		const int count = sprite_line_end - sprite_line_start;
+
+		if (ppu_tile_kernels && count > 0) {
+			uint16 *out = tile_kernels_check ? kernelCheckRow : dst + sprite_line_start;
+
+			if (tile_kernels_check) {
+				memcpy(out, dst + sprite_line_start, count * sizeof(uint16));
 			}
-		} else if((!flip_spr_hor) && (flip_spr_ver)) {
-			for(j = 15; j >= 0; j--) {
-				for(i = 7; i >= 0; i--) {
-					int spriteVal = (((ppu_memory[spr_start + 8 + j] >> i) & 1) << 1) | ((ppu_memory[spr_start + j] >> i) & 1);
-					if (spriteVal!=0) spriteVal += attribsAdd;
-					*spritePtr++ = spriteVal;
-				}
+			ppu_tile_kernels->sprite_row(out, spr + sprite_line_start, count, sprite_colors);
+
+			// drawn and cleared, nothing left for the loop below
+			if (!tile_kernels_check) {
+				memset(spr + sprite_line_start, 0, count);
+				sprite_line_start = SPRITE_LINE_WIDTH;
 			}
-		} else if((flip_spr_hor) && (flip_spr_ver)) {
-			for(j = 15; j >= 0; j--) {
-				for(i = 0; i < 8; i++) {
-					int spriteVal = (((ppu_memory[spr_start + 8 + j] >> i) & 1) << 1) | ((ppu_memory[spr_start + j] >> i) & 1);
-					if (spriteVal!=0) spriteVal += attribsAdd;
-					*spritePtr++ = spriteVal;
-				}
+		}
+#endif
+
+		for (x = sprite_line_start; x < sprite_line_end; x++) {
+			const int s = spr[x];
+			if (s == 0) continue;
+
+			if (!(s & SPRITE_PIXEL_BEHIND) || (dst[x] & BIT_16) == 0) {
+				dst[x] = sprite_colors[s & 15];
 			}
+			spr[x] = 0;
 		}
 
-		spritePtr = (unsigned char*)sprite;
-		for(j = 0; j < 16; j++) {
-			// account for 0-7 scroll X offset of background row
-			const int xp = x + scrollRowX[((y+j) >> 3) & 31];
-			unsigned char *sprcachePtr = (unsigned char*)&sprcache[y+j][xp];
-			unsigned short *bgPtr = dst + xp;
-
-			for(i = 0; i < 8; i++) {
-				// cache pixel for sprite zero detection
-				const unsigned char value = *spritePtr++;
-				if(spr_nr == 0)
-					*sprcachePtr++ = value;
-
-				if(value != 0) {
-					// sprite priority check
-					if(!disp_spr_back) {
-						*(bgPtr + i) = palette3DO[ppu_memory[0x3f10 + value]];
-					} else {
-						// draw the sprite pixel if the background pixel is transparent (0)
-						if((*(bgPtr + i) & BIT_16) == 0) {
-							*(bgPtr + i) = palette3DO[ppu_memory[0x3f10 + value]];
-						}
-					}
-				}
+#if TILE_KERNELS
+		// the line just drawn with the loop above
+		if (ppu_tile_kernels && tile_kernels_check && count > 0 && memcmp(kernelCheckRow, dst + sprite_line_start, count * sizeof(uint16)) != 0) {
+			tile_kernels_mismatches++;
+		}
+#endif
+	}
+
+	sprite_line_start = SPRITE_LINE_WIDTH;
+	sprite_line_end = 0;
+}
+
+void evaluate_sprites()
+{
+	// Sort OAM once per frame into per scanline buckets, each bucket keeps its sprites in OAM order like the secondary OAM does.
+	// Buckets hold all the sprites of a line, the 8 sprite limit is applied when drawing so it can be switched off.
+	// Hardware quirks of the overflow flag (the buggy diagonal OAM scan) are not emulated, it's set on the first line with more than 8.
+	int n, line;
+	const int spr_height = sprite_16 ? 16 : 8;
+
+	memcpy(sprite_eval_oam, sprite_memory, SPRITE_MEMORY);
+	memset(sprite_line_count, 0, sizeof(sprite_line_count));
+	sprite_overflow_line = -1;
+
+	for(n = 0; n < 64; n++) {
+		const int y = sprite_eval_oam[n << 2];
+		int last = y + spr_height;
+
+		// sprites at Y >= 240 are hidden
+		if (y >= NES_screen_height) continue;
+		if (last > NES_screen_height) last = NES_screen_height;
+
+		for(line = y; line < last; line++) {
+			const int count = sprite_line_count[line];
+			sprite_line_list[line][count] = n;
+			sprite_line_count[line] = count + 1;
+
+			if (count == SPRITES_PER_LINE_MAX && (sprite_overflow_line < 0 || line < sprite_overflow_line)) {
+				sprite_overflow_line = line;
 			}
-			dst += screenCel->ccb_Width;
 		}
 	}
 }
 
-void check_sprite_hit(int scanline)
+static uint32 bg_opaque_bits(uint32 v, int x)
 {
-	// sprite zero detection
+	// opacity of the 8 background pixels starting at screen x, on the line described by loopy v (MSB = leftmost pixel)
+	uint32 bits = 0;
 	int i;
-	uint16 *bgcachePtr = (uint16*)screenCel->ccb_SourcePtr + (scanline-1) * screenCel->ccb_Width;
-	uint8 *sprcachePtr = (uint8*)&sprcache[scanline-1][0];
-	
-	if (!shouldCheckSprCache[scanline-6]) return;	// temporary hack (used to be scanline or scanline-1) to make the super mario score board not break, will investigate later why
-
-	for(i = 0; i < NES_screen_width; i++) {
-		if((bgcachePtr[i] | sprcachePtr[i])!=0) {
-			// set the sprite zero flag
-			ppu_status |= 0x40;
-			return;
+	const int px = x + loopyX;
+
+	for (i=0; i<2; ++i) {
+		int coarse_x = (v & 0x1f) + (px >> 3) + i;
+		int slot = (v >> 10) & 3;
+		int pt_addr;
+
+		// every 32 tiles cross into the other horizontal nametable, up to twice from a line's last tiles
+		slot ^= (coarse_x >> 5) & 1;
+		coarse_x &= 31;
+
+		pt_addr = (nametable_slot[slot][(v & 0x03e0) + coarse_x] << 4) + ((v & 0x7000) >> 12);
+		if(background_addr_hi)
+			pt_addr+=0x1000;
+
+		bits = (bits << 8) | ppu_memory[pt_addr] | ppu_memory[pt_addr + 8];
+	}
+
+	return (bits << (px & 7)) >> 8 & 0xff;
+}
+
+void predict_sprite0_hit()
+{
+	// Find the first opaque sprite 0 pixel over an opaque background pixel, once per frame after the sprite evaluation.
+	// The background is sampled with the scroll registers as they are at the start of the frame, like the renderer does for the next lines.
+	const int y = sprite_eval_oam[0];
+	const int pattern_number = sprite_eval_oam[1];
+	const int attribs = sprite_eval_oam[2];
+	const int x = sprite_eval_oam[3];
+	const int spr_height = sprite_16 ? 16 : 8;
+
+	int spr_start;
+	int line, row;
+	uint32 v = loopyV;
+	uint32 clip_mask = 0xff;
+
+	sprite0_hit_line = -1;
+	sprite0_hit_x = -1;
+
+	if (!sprite_on || !background_on) return;
+	if (y >= NES_screen_height || x == 255) return;
+
+	// hidden pixels of either layer in the left 8 pixels never hit
+	if (x < 8 && (!background_clipping_off || !sprite_clipping_off)) {
+		clip_mask = 0xff >> (8 - x);
+	}
+
+	// and the hit never happens at x = 255
+	if (x > 247) {
+		clip_mask &= 0xff << (x - 247);
+	}
+
+	if(!sprite_16) {
+		spr_start = ((pattern_number << 3) << 1);
+		if(sprite_addr_hi)
+			spr_start += 0x1000;
+	} else {
+		spr_start = ((pattern_number & 1) << 12) + ((pattern_number & 0xfe) << 4);
+	}
+
+	// the line the renderer draws sprite 0 on, evaluate_sprites buckets sprites from their OAM Y (not Y + 1 like the hardware)
+	for (line = 0; line < y + spr_height && line < NES_screen_height; ++line) {
+		uint32 bits;
+		int row_addr;
+
+		v = (v & 0xfbe0) | (loopyT & 0x041f);
+
+		row = line - y;
+		if (row >= 0) {
+			if (attribs & 0x80) row = spr_height - 1 - row;
+			row_addr = spr_start + ((row & 8) << 1) + (row & 7);
+
+			bits = ppu_memory[row_addr] | ppu_memory[row_addr + 8];
+			if (attribs & 0x40) bits = byte_reverse[bits];
+
+			bits &= clip_mask;
+			if (bits) bits &= bg_opaque_bits(v, x);
+
+			if (bits) {
+				int i = 0;
+				while (!(bits & 0x80)) {
+					bits <<= 1;
+					i++;
+				}
+				sprite0_hit_line = line;
+				sprite0_hit_x = x + i;
+				return;
+			}
 		}
+
+		v = loopy_next_line(v);
 	}
 }
 
 void render_sprites()
 {
-	int i = 0;
+	int i, line;
+	int colors_changed = 0;
+
+	// the 16 sprite colors only need to be looked up once per frame
+	for(i = 0; i < 16; i++) {
+		const uint16 color = palette3DO[ppu_memory[0x3f10 + i]];
+		if (color != sprite_colors[i]) {
+			sprite_colors[i] = color;
+			colors_changed = 1;
+		}
+	}
 
-	// clear sprite cache
-	memset(sprcache,0,sizeof(sprcache));
-	memset(shouldCheckSprCache, 0, sizeof(shouldCheckSprCache));
+	// indexed sprite pixels don't depend on the colors
+	if (outputMode == OUTPUT_INDEXED_8BPP) colors_changed = 0;
 
-	// fetch all 64 sprites out of the sprite memory 4 bytes at a time and render the sprite
-	// sprites are drawn in priority from sprite 64 to 0
-	for(i = 63; i >= 0; i--) 
-	{
-		render_sprite(sprite_memory[i * 4 + 3], sprite_memory[i * 4], sprite_memory[i * 4 + 1], sprite_memory[i * 4 + 2], i);
+	if (!sprite_on) return;
+
+	// only the sprites in each line's bucket are drawn, into the sprite line first and then onto the screen
+	for(line = 0; line < NES_screen_height; line++) {
+		int count = sprite_line_count[line];
+		if (sprite_limit_enabled && count > SPRITES_PER_LINE_MAX)
+			count = SPRITES_PER_LINE_MAX;
+
+		// unchanged lines still have their sprites, new colors just get drawn over the same pixels
+		if (!line_changed[line]) {
+			if (!colors_changed || count == 0) continue;
+			line_changed[line] = 1;
+		}
+
+		if (count == 0) continue;
+
+		// the bucket is in OAM order, which is front to back
+		for(i = 0; i < count; i++) {
+			render_sprite_line(line, sprite_line_list[line][i]);
+		}
+		composite_sprite_line(line);
 	}
 }
@@ -45,6 +45,59 @@ extern unsigned int ppu_bgscr_f;
 
 extern unsigned int sprite_address;
 
+enum { MIRROR_HORIZONTAL, MIRROR_VERTICAL, MIRROR_ONE_SCREEN_LO, MIRROR_ONE_SCREEN_HI, MIRROR_FOUR_SCREEN };
+
+extern unsigned char nametable_ram[0x1000];
+extern unsigned char *nametable_slot[4];
+extern int nametable_slot_page[4];
+extern int mirroring_mode;
+
+// 1KB pages of PPU memory tracked for changes, pattern tables are pages 0-7 and nametable RAM pages 8-11
+#define VRAM_PAGE_NAMETABLE 8
+#define VRAM_PAGES 12
+
+extern unsigned int vram_page_version[VRAM_PAGES];
+
+extern unsigned char line_changed[240];
+
+#define SPRITES_PER_LINE_MAX 8
+// set in sprite line pixels that have background priority
+#define SPRITE_PIXEL_BEHIND 0x20
+
+extern int sprite_overflow_line;
+extern int sprite_limit_enabled;
+
+extern int sprite0_hit_line;
+extern int sprite0_hit_x;
+
+extern unsigned int palette_version;
+extern unsigned int palette_dirty;
+extern unsigned int bg_palette_version[4];
+
+// pre-colored background tiles, the budget covers the tile pixels and the bookkeeping (bytes)
+#define TILE_CACHE_ENABLED 0
+#define TILE_CACHE_BUDGET (96 * 1024)
+
+extern int tile_cache_enabled;
+extern int tile_cache_budget;
+extern unsigned int tile_cache_hits;
+extern unsigned int tile_cache_misses;
+
+// host builds expand 16bpp background lines and composite sprites with the SIMD kernels of host/tile_kernels.c
+#ifndef TILE_KERNELS
+#define TILE_KERNELS 0
+#endif
+
+#if TILE_KERNELS
+#include "tile_kernels.h"
+
+// the kernels used, picked by init_ppu, NULL for the tilemix/palmap32 path
+extern const tile_kernels *ppu_tile_kernels;
+// draws with the tables and counts the lines the kernels would have drawn differently
+extern bool tile_kernels_check;
+extern unsigned int tile_kernels_mismatches;
+#endif
+
 extern unsigned int loopyT;
 extern unsigned int loopyV;
 extern unsigned int loopyX;
@@ -60,11 +113,21 @@ extern int mw_ppu_0x4014;
 
 void init_ppu();
 void show_gfxcache();
-void write_ppu_memory(unsigned int address,unsigned char data);
+void ppu_load_chr(unsigned int address, const unsigned char *src, int size);
+void ppu_set_mirroring(int mode);
+unsigned char read_ppu_memory(unsigned int address);
+void write_ppu_register(unsigned int reg, unsigned char data);
+void ppu_sprite_dma(unsigned char data);
+void ppu_end_vram_burst();
 void render_background(int scanline);
+void evaluate_sprites();
 void render_sprites();
-void check_sprite_hit(int scanline);
+void predict_sprite0_hit();
 void updatePalmap32();
 void update_scanline_values(int scanline, int times);
+void invalidate_line_signatures();
+int tile_cache_reset();
+int tile_cache_memory();
+int lines_need_render(int scanline, int lines);
 
 #endif
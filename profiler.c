@@ -0,0 +1,118 @@
+/*
+ * profiler.c - where each frame's time goes
+ */
+
+#include "profiler.h"
+
+#if PROFILER
+
+#include <stdio.h>
+
+#include "platform.h"
+
+// sections started inside others, deeper than this go uncounted
+#define PROFILE_STACK_DEPTH 8
+
+static const char *sectionNames[PROFILE_SECTIONS_NUM] = {
+	"cpu", "scanline_values", "background", "sprites", "palmap", "present", "display"
+};
+
+static uint32 frameUs[PROFILE_SECTIONS_NUM];
+static int stack[PROFILE_STACK_DEPTH];
+static int depth = 0;
+static uint32 lastUs = 0;
+
+static uint16 history[PROFILER_FRAMES][PROFILE_SECTIONS_NUM];
+static int historyNext = 0;
+static int historyCount = 0;
+
+
+static void chargeRunning(uint32 now)
+{
+	if (depth > 0 && depth <= PROFILE_STACK_DEPTH) {
+		frameUs[stack[depth - 1]] += now - lastUs;
+	}
+	lastUs = now;
+}
+
+void profile_begin(int section)
+{
+	chargeRunning(platform_usec());
+
+	if (depth < PROFILE_STACK_DEPTH) stack[depth] = section;
+	depth++;
+}
+
+void profile_end(int section)
+{
+	chargeRunning(platform_usec());
+
+	if (depth > 0) depth--;
+}
+
+void profile_next_frame()
+{
+	uint16 *frame = history[historyNext];
+	int i;
+
+	// a section still running carries on into the next frame
+	chargeRunning(platform_usec());
+
+	for (i=0; i<PROFILE_SECTIONS_NUM; ++i) {
+		frame[i] = (frameUs[i] > 0xffff) ? 0xffff : frameUs[i];
+		frameUs[i] = 0;
+	}
+
+	historyNext = (historyNext + 1) % PROFILER_FRAMES;
+	if (historyCount < PROFILER_FRAMES) historyCount++;
+}
+
+int profile_frames()
+{
+	return historyCount;
+}
+
+const uint16 *profile_frame(int age)
+{
+	return history[(historyNext - 1 - age + 2 * PROFILER_FRAMES) % PROFILER_FRAMES];
+}
+
+const char *profile_section_name(int section)
+{
+	return sectionNames[section];
+}
+
+bool profile_write_csv(char *filename)
+{
+	// a header and a line per frame, 6 digits per value at most
+	const int lineSize = PROFILE_SECTIONS_NUM * 7 + 8;
+	char *csv = (char*)platform_alloc((historyCount + 1) * lineSize + 64 * PROFILE_SECTIONS_NUM);
+	int size = 0;
+	int age, i;
+	bool ok;
+
+	if (!csv) return false;
+
+	size += sprintf(csv + size, "frame");
+	for (i=0; i<PROFILE_SECTIONS_NUM; ++i) {
+		size += sprintf(csv + size, ",%s_us", sectionNames[i]);
+	}
+	size += sprintf(csv + size, "\n");
+
+	for (age=historyCount-1; age>=0; --age) {
+		const uint16 *frame = profile_frame(age);
+
+		size += sprintf(csv + size, "%d", historyCount - 1 - age);
+		for (i=0; i<PROFILE_SECTIONS_NUM; ++i) {
+			size += sprintf(csv + size, ",%d", frame[i]);
+		}
+		size += sprintf(csv + size, "\n");
+	}
+
+	ok = platform_file_write(filename, csv, size);
+	platform_free(csv);
+
+	return ok;
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * profiler.h - where each frame's time goes
+ *
+ * Sections are timed exclusively: one started inside another pauses it, so the sections of a frame
+ * stack up to the time the profiler saw. A frame runs from one run_frame to the next, display
+ * included, and the last PROFILER_FRAMES of them are kept. With PROFILER 0 every macro is empty and
+ * profiler.c compiles to nothing.
+ */
+
+#ifndef LAMENES_PROFILER_H
+#define LAMENES_PROFILER_H
+
+#include "types.h"
+
+// set to 1 here or from the build ("make PROFILER=1")
+#ifndef PROFILER
+#define PROFILER 0
+#endif
+
+#define PROFILER_FRAMES 256
+
+enum {
+	PROFILE_CPU,			// CPU slices
+	PROFILE_SCANLINE_VALUES,	// update_scanline_values
+	PROFILE_BACKGROUND,		// render_background
+	PROFILE_SPRITES,		// render_sprites
+	PROFILE_PALMAP,			// updatePalmap32
+	PROFILE_PRESENT,		// drawNESscreenCELs, or the host's conversion
+	PROFILE_DISPLAY,		// displayScreen
+	PROFILE_SECTIONS_NUM
+};
+
+#if PROFILER
+
+#define PROFILE_BEGIN(section) profile_begin(section)
+#define PROFILE_END(section) profile_end(section)
+#define PROFILE_NEXT_FRAME() profile_next_frame()
+
+extern void profile_begin(int section);
+extern void profile_end(int section);
+// closes the frame timed so far into the history
+extern void profile_next_frame();
+
+// frames in the history, up to PROFILER_FRAMES
+extern int profile_frames();
+// microseconds per section of a frame, age 0 is the last one closed
+extern const uint16 *profile_frame(int age);
+extern const char *profile_section_name(int section);
+// the history as CSV, oldest frame first, where the platform can write files
+extern bool profile_write_csv(char *filename);
+
+#else
+
+#define PROFILE_BEGIN(section)
+#define PROFILE_END(section)
+#define PROFILE_NEXT_FRAME()
+
+#endif
+
+#endif
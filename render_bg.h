@@ -0,0 +1,174 @@
+/*
+ * render_bg.h - background renderer template
+ *
+ * Included by ppu.c once per variant, with these defined:
+ * BG_FUNC        name of the function to generate
+ * BG_PER_TILE    1 renders a whole 8 line tile row, 0 a single line
+ * BG_PATTERN_HI  1 fetches the patterns from $1000, 0 from $0000
+ * BG_INDEXED     1 stores 8bpp palette indices, 0 16bpp colors from palmap32
+ * BG_CACHED      1 copies pre-colored tiles from the tile cache (tile rows need fine Y 0)
+ */
+
+#if BG_INDEXED
+#define BG_PIXEL_BYTES 1
+#define BG_COPY_ROW(dst32, src32) \
+	*(dst32) = *(src32); \
+	*((dst32)+1) = *((src32)+1);
+#define BG_PUT_ROW(dst32, nibbles) \
+	*(dst32) = PIXEL_PAIR16(nibble_pair_bytes[(nibbles) >> 24], nibble_pair_bytes[((nibbles) >> 16) & 255]); \
+	*((dst32)+1) = PIXEL_PAIR16(nibble_pair_bytes[((nibbles) >> 8) & 255], nibble_pair_bytes[(nibbles) & 255]);
+#else
+#define BG_PIXEL_BYTES 2
+#define BG_COPY_ROW(dst32, src32) \
+	*(dst32) = *(src32); \
+	*((dst32)+1) = *((src32)+1); \
+	*((dst32)+2) = *((src32)+2); \
+	*((dst32)+3) = *((src32)+3);
+#define BG_PUT_ROW(dst32, nibbles) \
+	*(dst32) = palSrc32[(nibbles) >> 24]; \
+	*((dst32)+1) = palSrc32[((nibbles) >> 16) & 255]; \
+	*((dst32)+2) = palSrc32[((nibbles) >> 8) & 255]; \
+	*((dst32)+3) = palSrc32[(nibbles) & 255];
+#endif
+
+static void BG_FUNC(int scanline, uint8 *dst)
+{
+	int run, tiles_left, tile_count;
+
+	const unsigned char *nt;
+	int nt_addr;
+	int at_addr;
+
+	int x_scroll;
+	int y_scroll;
+	uint32 *xy_scroll_pair;
+
+#if !BG_CACHED || !BG_PER_TILE
+	int pt_addr_off;
+#endif
+#if BG_CACHED
+	const int pt_base = BG_PATTERN_HI ? 0x1000 : 0;
+	const int row_words = BG_PIXEL_BYTES << 1;
+#endif
+
+	const uint32 loopyVval = loopyVtab[scanline];
+#if !BG_CACHED
+#if !BG_INDEXED
+	const uint32 *palSrc32 = (uint32*)palmap32;
+#endif
+	const uint32 *tilemixAttribOffset = (uint32*)tilemix;
+#endif
+#if BG_PER_TILE
+	const uint32 screenWidthInDwords = (screen.pitch * BG_PIXEL_BYTES) >> 2;
+#endif
+
+	x_scroll = (loopyVval & 0x1f);
+	y_scroll = (loopyVval & 0x03e0) >> 5;
+
+	nt = nametable_slot[(loopyVval >> 10) & 3];
+	nt_addr = loopyVval & 0x03ff;
+	at_addr = 0x03c0 + ((y_scroll & 0xfffc) << 1);
+#if !BG_CACHED || !BG_PER_TILE
+	pt_addr_off = ((loopyVval & 0x7000) >> 12) + (BG_PATTERN_HI ? 0x1000 : 0);
+#endif
+
+	xy_scroll_pair = (uint32*)&xy_scroll_tab[(y_scroll >> 1) & 1][x_scroll];
+
+	// 33 tiles in two runs, up to the end of this nametable row and then from the start of the next nametable's,
+	// so crossing needs no test in the tile loop whatever the mirroring
+	run = 32 - x_scroll;
+	tiles_left = 33;
+
+	for (;;) {
+		for(tile_count = 0; tile_count < run; tile_count++)
+		{
+			const int attribs = (nt[at_addr + (x_scroll >> 2)] >> *xy_scroll_pair++) & 3;
+#if BG_CACHED
+			const uint32 *src32 = tile_cache_get((nt[nt_addr] << 4) + pt_base, attribs);
+			uint32 *dst32 = (uint32*)dst;
+
+#if BG_PER_TILE
+			int i;
+			for (i=0; i<8; ++i) {
+				BG_COPY_ROW(dst32, src32)
+				src32 += row_words;
+				dst32 += screenWidthInDwords;
+			}
+#else
+			src32 += (pt_addr_off & 7) * row_words;
+			BG_COPY_ROW(dst32, src32)
+#endif
+
+#else
+			const uint32 attribBits = attribBitsTab[attribs];
+			const int pt_addr = (nt[nt_addr] << 4) + pt_addr_off;
+
+#if BG_PER_TILE
+			int i;
+			uint32 *bp = (uint32*)&ppu_memory[pt_addr];
+			uint32 *dstc32 = (uint32*)dst;
+
+			for (i=0; i<2; ++i) {
+				// pattern bytes in the order the shifts below expect
+				const uint32 up2 = LOAD_BE32(bp+2);
+				const uint32 up1 = LOAD_BE32(bp);
+
+				{
+					const uint32 tilemixNibbles = *(tilemixAttribOffset + ((up2 >> 16) & 0xFF00) + (up1 >> 24)) & attribBits;
+					BG_PUT_ROW(dstc32, tilemixNibbles)
+					dstc32 += screenWidthInDwords;
+				}
+
+				{
+					const uint32 tilemixNibbles = *(tilemixAttribOffset + ((up2 >> 8) & 0xFF00) + ((up1 >> 16) & 0xFF)) & attribBits;
+					BG_PUT_ROW(dstc32, tilemixNibbles)
+					dstc32 += screenWidthInDwords;
+				}
+
+				{
+					const uint32 tilemixNibbles = *(tilemixAttribOffset + (up2 & 0xFF00) + ((up1 >> 8) & 0xFF)) & attribBits;
+					BG_PUT_ROW(dstc32, tilemixNibbles)
+					dstc32 += screenWidthInDwords;
+				}
+
+				{
+					const uint32 tilemixNibbles = *(tilemixAttribOffset + ((up2 << 8) & 0xFF00) + (up1 & 0xFF)) & attribBits;
+					BG_PUT_ROW(dstc32, tilemixNibbles)
+					dstc32 += screenWidthInDwords;
+				}
+				bp++;
+			}
+#else
+			const uint32 p1 = ppu_memory[pt_addr];
+			const uint32 p2 = ppu_memory[pt_addr + 8];
+			const uint32 tilemixNibbles = *(tilemixAttribOffset + (p2 << 8) + p1) & attribBits;
+			uint32 *dst32 = (uint32*)dst;
+
+			BG_PUT_ROW(dst32, tilemixNibbles)
+#endif
+#endif
+			dst += BG_PIXEL_BYTES << 3;
+
+			nt_addr++;
+			x_scroll++;
+		}
+
+		tiles_left -= run;
+		if (tiles_left == 0) break;
+
+		// switch name/attrib tables
+		nt = nametable_slot[((loopyVval >> 10) & 3) ^ 1];
+		nt_addr -= 0x0020;
+		x_scroll = 0;
+		run = tiles_left;
+	}
+}
+
+#undef BG_PUT_ROW
+#undef BG_COPY_ROW
+#undef BG_PIXEL_BYTES
+#undef BG_FUNC
+#undef BG_PER_TILE
+#undef BG_PATTERN_HI
+#undef BG_INDEXED
+#undef BG_CACHED
@@ -0,0 +1,237 @@
+/*
+ * rewind.c - rewind history
+ */
+
+#include <string.h>
+
+#include "lamenes.h"
+#include "memory.h"
+#include "ppu.h"
+#include "state.h"
+#include "rewind.h"
+#include "platform.h"
+
+typedef struct {
+	int32 size;
+	int32 pages;
+	// registers at the previous rewind point, followed by its pages that changed since
+	SnapshotRegisters regs;
+} RewindRecord;
+
+typedef struct {
+	int32 index;
+	uint8 data[256];
+} RewindPage;
+
+// the budget covers the state at the newest rewind point and the ring of records before it
+int rewind_budget = REWIND_BUDGET;
+
+static Snapshot *shadow = NULL;
+static uint8 *ring = NULL;
+static int ringSize = 0;
+
+// records from oldest to newest, as offsets into the ring
+static int recordStart[REWIND_RECORDS_MAX];
+static int recordOldest = 0;
+static int recordCount = 0;
+
+static int framesSinceRecord = 0;
+
+// VRAM and palette are tracked through the versions their write paths bump
+static unsigned int recordedVramVersion[VRAM_PAGES];
+static unsigned int recordedPaletteVersion;
+
+
+static RewindRecord *recordAt(int n)
+{
+	return (RewindRecord*)&ring[recordStart[(recordOldest + n) % REWIND_RECORDS_MAX]];
+}
+
+static uint8 *shadowPage(int page)
+{
+	return (uint8*)&shadow->mem + (page << 8);
+}
+
+static void copyToShadow(int page, const uint8 *src)
+{
+	memcpy(shadowPage(page), src, 256);
+}
+
+static void forgetChanges()
+{
+	// the running emulator matches the shadow from here
+	int i;
+
+	memset(memory_page_dirty, 0, sizeof(memory_page_dirty));
+	for (i=0; i<VRAM_PAGES; ++i) {
+		recordedVramVersion[i] = vram_page_version[i];
+	}
+	recordedPaletteVersion = palette_version;
+}
+
+static int changedPages(int16 *list)
+{
+	int n = 0;
+	int page, i;
+
+	for (page=0; page<(CPU_MEMORY >> 8); ++page) {
+		const int kept = snapshot_cpu_page(page);
+
+		// the I/O register pages also get written around write_memory
+		if (kept >= 0 && (memory_page_dirty[page] || page == 0x20 || page == 0x40)) list[n++] = kept;
+	}
+
+	for (page=0; page<VRAM_PAGES; ++page) {
+		if (vram_page_version[page] != recordedVramVersion[page]) {
+			const int first = (page < VRAM_PAGE_NAMETABLE) ? SNAPSHOT_PAGE_PATTERN + (page << 2) : SNAPSHOT_PAGE_NAMETABLE + ((page - VRAM_PAGE_NAMETABLE) << 2);
+			for (i=0; i<4; ++i) {
+				list[n++] = first + i;
+			}
+		}
+	}
+
+	if (palette_version != recordedPaletteVersion) list[n++] = SNAPSHOT_PAGE_PALETTE;
+
+	// sprite DMA rewrites it nearly every frame
+	list[n++] = SNAPSHOT_PAGE_OAM;
+
+	return n;
+}
+
+static int allocRecord(int size)
+{
+	// returns the ring offset for a new record, dropping the oldest ones until it fits
+	for (;;) {
+		const RewindRecord *newest;
+		int tail, newestEnd;
+
+		if (recordCount == 0) return 0;
+
+		if (recordCount < REWIND_RECORDS_MAX) {
+			newest = recordAt(recordCount - 1);
+			newestEnd = (int)((uint8*)newest - ring) + newest->size;
+			tail = recordStart[recordOldest];
+
+			if (tail < newestEnd) {
+				// free at the end of the ring and before the oldest record
+				if (newestEnd + size <= ringSize) return newestEnd;
+				if (size <= tail) return 0;
+			} else {
+				if (newestEnd + size <= tail) return newestEnd;
+			}
+		}
+
+		recordOldest = (recordOldest + 1) % REWIND_RECORDS_MAX;
+		recordCount--;
+	}
+}
+
+static void record()
+{
+	int16 list[SNAPSHOT_PAGES];
+	const int n = changedPages(list);
+	// kept 8 byte aligned for the clock fields
+	const int size = ((int)sizeof(RewindRecord) + n * (int)sizeof(RewindPage) + 7) & ~7;
+	RewindRecord *r = NULL;
+	RewindPage *p;
+	int i;
+
+	if (size <= ringSize) {
+		const int start = allocRecord(size);
+		recordStart[(recordOldest + recordCount) % REWIND_RECORDS_MAX] = start;
+		recordCount++;
+
+		r = (RewindRecord*)&ring[start];
+		r->size = size;
+		r->pages = n;
+		r->regs = shadow->regs;
+	} else {
+		// can't undo past this point
+		recordCount = 0;
+	}
+
+	p = r ? (RewindPage*)(r + 1) : NULL;
+	for (i=0; i<n; ++i) {
+		if (p) {
+			p[i].index = list[i];
+			memcpy(p[i].data, shadowPage(list[i]), 256);
+		}
+		copyToShadow(list[i], snapshot_live_page(list[i]));
+	}
+	snapshot_save_registers(&shadow->regs);
+
+	forgetChanges();
+}
+
+bool rewind_enabled()
+{
+	return shadow != NULL;
+}
+
+bool rewind_reset()
+{
+	platform_free(shadow);
+	platform_free(ring);
+	shadow = NULL;
+	ring = NULL;
+
+	recordOldest = recordCount = 0;
+	framesSinceRecord = 0;
+
+	ringSize = (rewind_budget - SNAPSHOT_SIZE) & ~7;
+	if (rewind_budget == 0 || ringSize < (int)sizeof(RewindRecord)) return false;
+
+	shadow = (Snapshot*)platform_alloc(SNAPSHOT_SIZE);
+	ring = (uint8*)platform_alloc(ringSize);
+	if (!shadow || !ring) {
+		platform_free(shadow);
+		platform_free(ring);
+		shadow = NULL;
+		ring = NULL;
+		return false;
+	}
+
+	snapshot_save(shadow);
+	forgetChanges();
+
+	return true;
+}
+
+void rewind_frame_done()
+{
+	if (!shadow) return;
+
+	if (++framesSinceRecord >= REWIND_INTERVAL) {
+		record();
+		framesSinceRecord = 0;
+	}
+}
+
+bool rewind_step_back()
+{
+	// The first step returns to the newest rewind point, the next ones undo a record each.
+	// Frames run in between (to show where we are) aren't counted, so they never hold a step back.
+	if (!shadow) return false;
+
+	if (framesSinceRecord == 0) {
+		RewindRecord *r;
+		const RewindPage *p;
+		int i;
+
+		if (recordCount == 0) return false;
+
+		r = recordAt(recordCount - 1);
+		p = (const RewindPage*)(r + 1);
+		for (i=0; i<r->pages; ++i) {
+			copyToShadow(p[i].index, p[i].data);
+		}
+		shadow->regs = r->regs;
+		recordCount--;
+	}
+
+	snapshot_load(shadow);
+	forgetChanges();
+	framesSinceRecord = 0;
+
+	return true;
+}
@@ -0,0 +1,29 @@
+/*
+ * rewind.h - rewind history
+ *
+ * Every REWIND_INTERVAL frames the state is recorded into a ring of rewind_budget bytes. A record only
+ * holds the registers and the 256 byte pages the write paths marked since the previous one, as they
+ * were before, so going back is undoing the newest record. The oldest records make room for new ones.
+ */
+
+#ifndef LAMENES_REWIND_H
+#define LAMENES_REWIND_H
+
+#include "types.h"
+
+// 0 disables rewinding, the history then takes no memory at all
+#define REWIND_BUDGET (256 * 1024)
+#define REWIND_INTERVAL 4
+#define REWIND_RECORDS_MAX 512
+
+extern int rewind_budget;
+
+// (re)allocates the history for rewind_budget and starts it from the current state, returns false if it's off
+extern bool rewind_reset();
+extern bool rewind_enabled();
+// after every frame played forward
+extern void rewind_frame_done();
+// goes back to the previous rewind point, returns false when there is none
+extern bool rewind_step_back();
+
+#endif
@@ -29,9 +29,6 @@
  * SUCH DAMAGE.
  */
 
-#include "../3DO/core.h"
-
-#include <filestreamfunctions.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -41,6 +38,7 @@
 #include "lamenes.h"
 #include "memory.h"
 #include "romloader.h"
+#include "platform.h"
 
 /* pointers to the nes headers */
 unsigned char header[15];
@@ -61,27 +59,28 @@ char title[128];
 
 int analyze_header(char *romfn)
 {
-	Stream *romfp;
+	PlatformFile *romfp;
 
-	romfp = OpenDiskStream(romfn, 0);
+	romfp = platform_file_open(romfn);
 	if (romfp == NULL)
 	{
 		return(1);
 	}
 
-	romlen = SeekDiskStream(romfp, 0, SEEK_END);
-
-	SeekDiskStream(romfp, 0, SEEK_SET);
+	romlen = platform_file_size(romfp);
 
-	ReadDiskStream(romfp, (char *)&header[0], 15);
+	if (platform_file_read(romfp, &header[0], 15) != 15)
+	{
+		platform_file_close(romfp);
+		return(1);
+	}
 
-	CloseDiskStream(romfp);
+	platform_file_close(romfp);
 
 
 	/* ines rom header must be: "NES\n" (HEX: 4E 45 53 1A), else exit */
 	if ((header[0] != 'N') || (header[1] != 'E') || (header[2] != 'S') || (header[3] != 0x1A))
 	{
-		free(header);
 		return(1);
 	}
 
@@ -232,38 +231,44 @@ int analyze_header(char *romfn)
 		break;
 	}
 
-	free(header);
-
 	return(0);
 }
 
 int load_rom(char *romfn)
 {
-	Stream *romfp;
+	PlatformFile *romfp;
+	int read;
 
-	romfp = OpenDiskStream(romfn, 0);
+	romfp = platform_file_open(romfn);
 	if (romfp == NULL)
 	{
 		return(1);
 	}
 
-	ReadDiskStream(romfp, (char *)&romcache[0x0000], romlen);
+	read = platform_file_read(romfp, &romcache[0x0000], romlen);
+
+	platform_file_close(romfp);
 
-	CloseDiskStream(romfp);
+	/* the banks mapped below must all be there */
+	if (read != romlen || romlen < 16 + PRG * 16384 + CHR * 8192)
+	{
+		return(1);
+	}
 
 
 	/* load prg data in memory */
+	cpu_unmap_prg();
 	if (PRG == 0x01)
 	{
 		/* map 16kb in mirror mode */
-		memcpy(memory + 0x8000, romcache + 16, 16384);
-		memcpy(memory + 0xC000, romcache + 16, 16384);
+		cpu_load_prg(0x8000, romcache + 16, 16384);
+		cpu_load_prg(0xC000, romcache + 16, 16384);
 	}
 	else
 	{
 		/* map 2x 16kb the first one into 8000 and the last one into c000 */
-		memcpy(memory + 0x8000, romcache + 16, 16384);
-		memcpy(memory + 0xC000, romcache + 16 + ((PRG - 1) * 16384), 16384);
+		cpu_load_prg(0x8000, romcache + 16, 16384);
+		cpu_load_prg(0xC000, romcache + 16 + ((PRG - 1) * 16384), 16384);
 	}
 
 	/* load chr data in ppu memory */
@@ -0,0 +1,155 @@
+/*
+ * scheduler.c - master clock and event queue
+ */
+
+#include "lame6502/lame6502.h"
+
+#include "scheduler.h"
+#include "state.h"
+
+master_clock_t master_clock = 0;
+int master_cycles_per_cpu_cycle = MASTER_CYCLES_PER_CPU_CYCLE_NTSC;
+
+// pending events, sorted by time (events due at the same time keep the order they were scheduled in)
+static master_clock_t queueWhen[EVENT_TYPES_NUM];
+static int queueType[EVENT_TYPES_NUM];
+static int queueLength = 0;
+
+// set while CPU_execute runs a slice, and the CPU cycles of that slice
+static int cpuRunning = 0;
+static int sliceCycles = 0;
+
+
+void scheduler_reset(int masterCyclesPerCpuCycle)
+{
+	master_clock = 0;
+	master_cycles_per_cpu_cycle = masterCyclesPerCpuCycle;
+	queueLength = 0;
+	cpuRunning = 0;
+	sliceCycles = 0;
+}
+
+master_clock_t cpu_master_clock()
+{
+	return master_clock + (sliceCycles - cycle_count) * master_cycles_per_cpu_cycle;
+}
+
+void cancel_event(int type)
+{
+	int i;
+
+	for (i=0; i<queueLength; ++i) {
+		if (queueType[i] == type) {
+			for (; i<queueLength-1; ++i) {
+				queueWhen[i] = queueWhen[i+1];
+				queueType[i] = queueType[i+1];
+			}
+			queueLength--;
+			return;
+		}
+	}
+}
+
+void schedule_event(int type, master_clock_t when)
+{
+	int i;
+
+	cancel_event(type);
+
+	for (i=queueLength; i>0 && queueWhen[i-1] > when; --i) {
+		queueWhen[i] = queueWhen[i-1];
+		queueType[i] = queueType[i-1];
+	}
+	queueWhen[i] = when;
+	queueType[i] = type;
+	queueLength++;
+
+	// the CPU loop exits after the current instruction once its cycles run out
+	if (cpuRunning) {
+		const int cycles = ((int)(when - master_clock) + master_cycles_per_cpu_cycle - 1) / master_cycles_per_cpu_cycle;
+		if (cycles < sliceCycles) {
+			const int cut = sliceCycles - cycles;
+			cycle_count -= cut;
+			sliceCycles -= cut;
+		}
+	}
+}
+
+int run_cpu_until_next_event()
+{
+	int ahead, executed;
+
+	if (queueLength == 0) return 0;
+
+	// within a frame of now, so the division stays 32 bit
+	ahead = (int)(queueWhen[0] - master_clock);
+	if (ahead <= 0) return 0;
+
+	sliceCycles = (ahead + master_cycles_per_cpu_cycle - 1) / master_cycles_per_cpu_cycle;
+	cpuRunning = 1;
+	CPU_execute(sliceCycles);
+	cpuRunning = 0;
+	// the slice may have been cut short while running, and the last instruction usually overshoots
+	executed = sliceCycles - cycle_count;
+	sliceCycles = 0;
+	cycle_count = 0;
+
+	master_clock += executed * master_cycles_per_cpu_cycle;
+
+	return executed;
+}
+
+void skip_to_next_event()
+{
+	if (queueLength > 0 && queueWhen[0] > master_clock) {
+		master_clock = queueWhen[0];
+	}
+}
+
+void add_cpu_cycles(int cycles)
+{
+	master_clock += cycles * master_cycles_per_cpu_cycle;
+}
+
+int next_due_event(master_clock_t *when)
+{
+	int i, type;
+
+	if (queueLength == 0 || queueWhen[0] > cpu_master_clock()) return -1;
+
+	type = queueType[0];
+	*when = queueWhen[0];
+
+	for (i=0; i<queueLength-1; ++i) {
+		queueWhen[i] = queueWhen[i+1];
+		queueType[i] = queueType[i+1];
+	}
+	queueLength--;
+
+	return type;
+}
+
+void scheduler_save_state(SchedulerState *s)
+{
+	int i;
+
+	s->clock = master_clock;
+	for (i=0; i<EVENT_TYPES_NUM; ++i) {
+		s->event_when[i] = (i < queueLength) ? queueWhen[i] : -1;
+		s->event_type[i] = (i < queueLength) ? queueType[i] : -1;
+	}
+	s->event_count = queueLength;
+	s->unused = 0;
+}
+
+void scheduler_load_state(const SchedulerState *s)
+{
+	int i;
+
+	master_clock = s->clock;
+	for (i=0; i<s->event_count; ++i) {
+		queueWhen[i] = s->event_when[i];
+		queueType[i] = s->event_type[i];
+	}
+	queueLength = s->event_count;
+}
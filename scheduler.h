@@ -0,0 +1,53 @@
+/*
+ * scheduler.h - master clock and event queue
+ *
+ * Time counts master clock cycles since power on, 12 per CPU cycle on NTSC and 16 on PAL.
+ * Each event type is pending at most once, the queue keeps them sorted by time and the CPU
+ * always runs exactly until the first one.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+// armcc has long long as an extension, 32 bits would wrap after less than two minutes
+typedef long long master_clock_t;
+
+#define MASTER_CYCLES_PER_CPU_CYCLE_NTSC 12
+#define MASTER_CYCLES_PER_CPU_CYCLE_PAL 16
+
+enum {
+	EVENT_VBLANK_START,
+	EVENT_NMI,
+	EVENT_VBLANK_END,
+	EVENT_SPRITE0_HIT,
+	EVENT_SPRITE_OVERFLOW,
+	EVENT_MAPPER_IRQ,
+	EVENT_APU_FRAME_IRQ,
+	EVENT_RENDER_CHECKPOINT,
+	EVENT_TYPES_NUM
+};
+
+// time of the last event taken, or of the end of the last CPU slice
+extern master_clock_t master_clock;
+extern int master_cycles_per_cpu_cycle;
+
+extern void scheduler_reset(int masterCyclesPerCpuCycle);
+
+// replaces the pending event of that type, if any, and cuts the running CPU slice short when it's due before its end
+extern void schedule_event(int type, master_clock_t when);
+extern void cancel_event(int type);
+
+// now, counting the cycles the CPU has run so far in the current slice
+extern master_clock_t cpu_master_clock();
+
+// runs the CPU until the first pending event, returns the CPU cycles run
+extern int run_cpu_until_next_event();
+// moves the clock to the first pending event without running the CPU
+extern void skip_to_next_event();
+// cycles the CPU spent outside CPU_execute (taking an NMI)
+extern void add_cpu_cycles(int cycles);
+
+// takes the first event due by now, returns its type or -1 if none
+extern int next_due_event(master_clock_t *when);
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * state.c - snapshots of the whole emulator state
+ */
+
+#include <string.h>
+
+#include "lame6502/lame6502.h"
+
+#include "nes_input.h"
+#include "ppu.h"
+#include "state.h"
+
+uint32 snapshot_session = 0;
+
+// sizes here are part of the format, a change needs a new SNAPSHOT_VERSION
+typedef char snapshot_size_check[(SNAPSHOT_SIZE == 40744) ? 1 : -1];
+typedef char snapshot_pads_check[(NES_PADS == 2) ? 1 : -1];
+
+
+static void cpu_save_state(CpuState *s)
+{
+	s->program_counter = program_counter;
+	s->stack_pointer = stack_pointer;
+	s->accumulator = accumulator;
+	s->x_reg = x_reg;
+	s->y_reg = y_reg;
+	s->flags = (sign_flag ? 0x80 : 0) |
+		(overflow_flag ? 0x40 : 0) |
+		0x20 |
+		(break_flag ? 0x10 : 0) |
+		(decimal_flag ? 0x08 : 0) |
+		(interrupt_flag ? 0x04 : 0) |
+		(zero_flag ? 0x02 : 0) |
+		(carry_flag ? 0x01 : 0);
+	s->irq_line = irq_line;
+}
+
+static void cpu_load_state(const CpuState *s)
+{
+	program_counter = s->program_counter;
+	stack_pointer = s->stack_pointer;
+	accumulator = s->accumulator;
+	x_reg = s->x_reg;
+	y_reg = s->y_reg;
+
+	// the same values the instructions leave in the flags
+	sign_flag = s->flags & 0x80;
+	overflow_flag = s->flags & 0x40;
+	break_flag = (s->flags >> 4) & 1;
+	decimal_flag = (s->flags >> 3) & 1;
+	interrupt_flag = (s->flags >> 2) & 1;
+	zero_flag = (s->flags >> 1) & 1;
+	carry_flag = s->flags & 1;
+
+	irq_line = s->irq_line;
+}
+
+static void input_save_state(InputState *s)
+{
+	memcpy(s->pad_state, pad_state, NES_PADS);
+	memcpy(s->pad_shift, pad_shift, NES_PADS);
+	s->pad_strobe = pad_strobe;
+	s->pad_latched = pad_latched;
+	memset(s->unused, 0, sizeof(s->unused));
+}
+
+static void input_load_state(const InputState *s)
+{
+	memcpy(pad_state, s->pad_state, NES_PADS);
+	memcpy(pad_shift, s->pad_shift, NES_PADS);
+	pad_strobe = s->pad_strobe;
+	pad_latched = s->pad_latched;
+}
+
+void snapshot_save_registers(SnapshotRegisters *s)
+{
+	scheduler_save_state(&s->timing);
+	cpu_save_state(&s->cpu);
+	mapper_save_state(&s->mapper);
+	input_save_state(&s->input);
+	ppu_save_state(&s->ppu);
+}
+
+unsigned char *snapshot_live_page(int page)
+{
+	if (page < SNAPSHOT_PAGE_CPU_IO) return &memory[page << 8];
+	if (page < SNAPSHOT_PAGE_PATTERN) return &memory[0x2000 + ((page - SNAPSHOT_PAGE_CPU_IO) << 8)];
+	if (page < SNAPSHOT_PAGE_PALETTE) return &ppu_memory[(page - SNAPSHOT_PAGE_PATTERN) << 8];
+	if (page < SNAPSHOT_PAGE_NAMETABLE) return &ppu_memory[0x3f00];
+	if (page < SNAPSHOT_PAGE_OAM) return &nametable_ram[(page - SNAPSHOT_PAGE_NAMETABLE) << 8];
+	return sprite_memory;
+}
+
+int snapshot_cpu_page(int cpuPage)
+{
+	if (cpuPage < 0x08) return SNAPSHOT_PAGE_RAM + cpuPage;
+	if (cpuPage >= 0x20 && cpuPage < 0x80) return SNAPSHOT_PAGE_CPU_IO + cpuPage - 0x20;
+	return -1;
+}
+
+int snapshot_save(void *buf)
+{
+	Snapshot *s = (Snapshot*)buf;
+
+	s->magic = SNAPSHOT_MAGIC;
+	s->version = SNAPSHOT_VERSION;
+	s->size = SNAPSHOT_SIZE;
+	s->session = snapshot_session;
+
+	snapshot_save_registers(&s->regs);
+
+	memcpy(s->mem.ram, memory, sizeof(s->mem.ram));
+	memcpy(s->mem.cpu_io, memory + 0x2000, sizeof(s->mem.cpu_io));
+	memcpy(s->mem.pattern, ppu_memory, sizeof(s->mem.pattern));
+	memcpy(s->mem.palette, ppu_memory + 0x3f00, sizeof(s->mem.palette));
+	memcpy(s->mem.nametable, nametable_ram, sizeof(nametable_ram));
+	memcpy(s->mem.oam, sprite_memory, SPRITE_MEMORY);
+
+	return SNAPSHOT_SIZE;
+}
+
+int snapshot_load(const void *buf)
+{
+	const Snapshot *s = (const Snapshot*)buf;
+	int i;
+
+	if (s->magic != SNAPSHOT_MAGIC || s->version != SNAPSHOT_VERSION || s->size != SNAPSHOT_SIZE) return -1;
+
+	for (i=0; i<0x2000; i+=0x800) {
+		memcpy(memory + i, s->mem.ram, sizeof(s->mem.ram));
+	}
+	memcpy(memory + 0x2000, s->mem.cpu_io, sizeof(s->mem.cpu_io));
+	memcpy(ppu_memory, s->mem.pattern, sizeof(s->mem.pattern));
+	memcpy(ppu_memory + 0x3f00, s->mem.palette, sizeof(s->mem.palette));
+	memcpy(nametable_ram, s->mem.nametable, sizeof(nametable_ram));
+	memcpy(sprite_memory, s->mem.oam, SPRITE_MEMORY);
+
+	scheduler_load_state(&s->regs.timing);
+	cpu_load_state(&s->regs.cpu);
+	// maps the ROM banks back in
+	mapper_load_state(&s->regs.mapper);
+	input_load_state(&s->regs.input);
+	// last, it invalidates what changed
+	ppu_load_state(&s->regs.ppu, s->session == snapshot_session);
+
+	return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * state.h - snapshots of the whole emulator state
+ *
+ * A snapshot is a fixed size block in memory, taken and restored between frames without any file I/O
+ * so rewind and run-ahead can afford one per frame. Each part is filled by the module owning that state.
+ * The layout only changes together with SNAPSHOT_VERSION, and every part is a multiple of 8 bytes so
+ * the 64 bit clock fields sit at the same offsets whatever the compiler's alignment rules. Fields are in
+ * the machine's byte order, on the other one the magic doesn't match and the snapshot isn't loaded.
+ */
+
+#ifndef LAMENES_STATE_H
+#define LAMENES_STATE_H
+
+#include "types.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "ppu.h"
+
+#define SNAPSHOT_MAGIC 0x4C4E5353	// "LNSS"
+#define SNAPSHOT_VERSION 4
+
+typedef struct {
+	master_clock_t clock;
+	// pending events in queue order
+	master_clock_t event_when[EVENT_TYPES_NUM];
+	int32 event_type[EVENT_TYPES_NUM];
+	int32 event_count;
+	int32 unused;
+} SchedulerState;
+
+typedef struct {
+	uint32 program_counter;
+	uint8 stack_pointer;
+	uint8 accumulator;
+	uint8 x_reg;
+	uint8 y_reg;
+	// packed like the status register
+	uint8 flags;
+	uint8 unused[3];
+	int32 irq_line;
+} CpuState;
+
+typedef struct {
+	int32 mmc1_reg_data[4];
+	int32 mmc1_reg_bitcount[4];
+	int32 mmc1_prgrom_area_switch;
+	int32 mmc1_prgrom_bank_switch;
+	int32 mmc1_chrrom_bank_switch;
+
+	int32 mmc3_cmd;
+	int32 mmc3_prg_bank0;
+	int32 mmc3_prg_bank1;
+	int32 mmc3_prg_page;
+	int32 mmc3_chr_xor;
+	int32 mmc3_irq_counter;
+	int32 mmc3_irq_latch;
+	int32 mmc3_irq_control0;
+	int32 mmc3_irq_control1;
+	int32 mmc3_irq_enable;
+	int32 unused;
+
+	// romcache offset of the bank in each 8KB page of $8000-$FFFF
+	int32 prg_rom_offset[4];
+} MapperState;
+
+typedef struct {
+	uint8 pad_state[2];
+	uint8 pad_shift[2];
+	uint8 pad_strobe;
+	uint8 pad_latched;
+	uint8 unused[2];
+} InputState;
+
+typedef struct {
+	uint32 control1;
+	uint32 control2;
+	uint32 status;
+	uint32 status_tmp;
+	uint32 addr;
+	uint32 addr_h;
+	uint32 addr_tmp;
+	uint32 bgscr_f;
+	uint32 sprite_address;
+	uint32 loopyT;
+	uint32 loopyV;
+	uint32 loopyX;
+	int32 mirroring_mode;
+	// what the memories held, loading skips invalidating pages still holding the same version
+	uint32 vram_page_version[VRAM_PAGES];
+	uint32 palette_version;
+	uint32 loopyVtab[240];
+} PpuState;
+
+typedef struct {
+	SchedulerState timing;
+	CpuState cpu;
+	MapperState mapper;
+	InputState input;
+	PpuState ppu;
+} SnapshotRegisters;
+
+// the memories that can't be rebuilt, seen as SNAPSHOT_PAGES pages of 256 bytes in this order
+typedef struct {
+	// $0000-$07FF, loading copies it to its mirrors up to $1FFF
+	uint8 ram[0x800];
+	// $2000-$7FFF, the ROM banks above come back from the mapper state
+	uint8 cpu_io[0x6000];
+	// PPU $0000-$1FFF
+	uint8 pattern[0x2000];
+	// PPU $3F00-$3FFF, $2000-$3EFF is only ever read through nametable_ram
+	uint8 palette[0x100];
+	uint8 nametable[0x1000];
+	uint8 oam[SPRITE_MEMORY];
+} SnapshotMemory;
+
+#define SNAPSHOT_PAGE_RAM 0
+#define SNAPSHOT_PAGE_CPU_IO (0x800 >> 8)
+#define SNAPSHOT_PAGE_PATTERN (SNAPSHOT_PAGE_CPU_IO + (0x6000 >> 8))
+#define SNAPSHOT_PAGE_PALETTE (SNAPSHOT_PAGE_PATTERN + (0x2000 >> 8))
+#define SNAPSHOT_PAGE_NAMETABLE (SNAPSHOT_PAGE_PALETTE + 1)
+#define SNAPSHOT_PAGE_OAM (SNAPSHOT_PAGE_NAMETABLE + (0x1000 >> 8))
+#define SNAPSHOT_PAGES (SNAPSHOT_PAGE_OAM + 1)
+
+typedef struct {
+	uint32 magic;
+	uint32 version;
+	uint32 size;
+	// versions only compare within the session that saved them
+	uint32 session;
+	SnapshotRegisters regs;
+	SnapshotMemory mem;
+} Snapshot;
+
+#define SNAPSHOT_SIZE ((int)sizeof(Snapshot))
+
+// buf holds SNAPSHOT_SIZE bytes (word aligned), returns the bytes written
+extern int snapshot_save(void *buf);
+// returns 0, or -1 leaving the emulator untouched if buf isn't a snapshot of this version
+extern int snapshot_load(const void *buf);
+
+extern uint32 snapshot_session;
+
+extern void snapshot_save_registers(SnapshotRegisters *s);
+// where a snapshot page lives in the running emulator
+extern unsigned char *snapshot_live_page(int page);
+// the snapshot page holding a 256 byte page of CPU memory, -1 for the RAM mirrors and the ROM banks
+extern int snapshot_cpu_page(int cpuPage);
+
+extern void scheduler_save_state(SchedulerState *s);
+extern void scheduler_load_state(const SchedulerState *s);
+extern void mapper_save_state(MapperState *s);
+extern void mapper_load_state(const MapperState *s);
+extern void ppu_save_state(PpuState *s);
+extern void ppu_load_state(const PpuState *s, bool sameSession);
+
+#endif
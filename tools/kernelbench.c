@@ -0,0 +1,116 @@
+/*
+ * kernelbench.c - pixels per nanosecond of each tile kernel variant on this host
+ *
+ * Every variant is first checked against the scalar one on the same random frame, "nesbench -c"
+ * checks them against the emulator's own renderer.
+ * Build with "make kernelbench", run as tools/kernelbench [frames].
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ppu.h"
+#include "tile_kernels.h"
+
+#define TILES_PER_LINE 33
+#define LINES 240
+#define LINE_PIXELS (TILES_PER_LINE * 8)
+
+static unsigned char plane0[LINES][TILES_PER_LINE];
+static unsigned char plane1[LINES][TILES_PER_LINE];
+static unsigned char attr[LINES][TILES_PER_LINE];
+static unsigned char sprites[LINES][LINE_PIXELS];
+static unsigned short bg_pal[16];
+static unsigned short spr_pal[16];
+
+static unsigned short reference[LINES][LINE_PIXELS];
+static unsigned short output[LINES][LINE_PIXELS];
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void make_frame(void)
+{
+	int y, x, i;
+
+	srand(1234);
+	for (i=0; i<16; ++i) {
+		bg_pal[i] = (rand() & 0x7fff) | 0x8000;
+		spr_pal[i] = rand() & 0x7fff;
+	}
+	bg_pal[4] = bg_pal[8] = bg_pal[12] = bg_pal[0] = rand() & 0x7fff;
+
+	for (y=0; y<LINES; ++y) {
+		for (x=0; x<TILES_PER_LINE; ++x) {
+			plane0[y][x] = rand();
+			plane1[y][x] = rand();
+			attr[y][x] = rand() & 3;
+		}
+		// about a quarter of the pixels covered by sprites, some of them behind the background
+		for (x=0; x<LINE_PIXELS; ++x) {
+			const int r = rand();
+			sprites[y][x] = (r & 3) ? 0 : (0x10 | ((r >> 2) & 15) | ((r & 64) ? SPRITE_PIXEL_BEHIND : 0));
+		}
+	}
+}
+
+static void render_frame(const tile_kernels *k, unsigned short (*dst)[LINE_PIXELS])
+{
+	int y;
+	for (y=0; y<LINES; ++y) {
+		k->bg_row(dst[y], plane0[y], plane1[y], attr[y], TILES_PER_LINE, bg_pal);
+		k->sprite_row(dst[y], sprites[y], LINE_PIXELS, spr_pal);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const tile_kernels *list[4];
+	const int frames = (argc > 1) ? atoi(argv[1]) : 2000;
+	const int n = tile_kernels_available(list, 4);
+	const double pixels = (double)frames * LINES * LINE_PIXELS;
+	int i, f, y;
+
+	make_frame();
+	render_frame(list[0], reference);
+
+	printf("%d frames of %dx%d, best variant: %s\n", frames, LINE_PIXELS, LINES, tile_kernels_select()->name);
+
+	for (i=0; i<n; ++i) {
+		const tile_kernels *k = list[i];
+		double start, bg_ns, spr_ns;
+
+		memset(output, 0, sizeof(output));
+		render_frame(k, output);
+		if (memcmp(output, reference, sizeof(output)) != 0) {
+			printf("%-8s MISMATCH with the scalar kernel\n", k->name);
+			return 1;
+		}
+
+		start = now_ns();
+		for (f=0; f<frames; ++f) {
+			for (y=0; y<LINES; ++y) {
+				k->bg_row(output[y], plane0[y], plane1[y], attr[y], TILES_PER_LINE, bg_pal);
+			}
+		}
+		bg_ns = now_ns() - start;
+
+		start = now_ns();
+		for (f=0; f<frames; ++f) {
+			for (y=0; y<LINES; ++y) {
+				k->sprite_row(output[y], sprites[y], LINE_PIXELS, spr_pal);
+			}
+		}
+		spr_ns = now_ns() - start;
+
+		printf("%-8s background %6.3f px/ns   sprites %6.3f px/ns\n", k->name, pixels / bg_ns, pixels / spr_ns);
+	}
+
+	return 0;
+}
@@ -0,0 +1,304 @@
+/*
+ * nesbench.c - frames and emulated cycles per second of a ROM on this host
+ *
+ * Runs the same frames three times from power on (or from the movie's start): CPU only like the
+ * LPAD path, rendered and presented, and rendered without presenting. The CRC of the last frame's
+ * picture tells builds that render differently apart. -c instead checks that every tile kernel
+ * variant draws each line like the tilemix/palmap32 renderer does.
+ * Build with "make nesbench", run as tools/nesbench [-f frames] [-m movie] [-k kernels] [-c] [-j] rom.nes
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lamenes.h"
+#include "scheduler.h"
+#include "movie.h"
+#include "ppu.h"
+#include "host.h"
+
+typedef struct {
+	const char *name;
+	bool render;
+	bool present;
+} BenchMode;
+
+typedef struct {
+	double seconds;
+	double cpu_cycles;
+	double p50, p90, p99, max;
+	uint32 crc;
+} BenchResult;
+
+static const BenchMode modes[] = {
+	{ "cpu", false, false },
+	{ "render", true, true },
+	{ "render_no_present", true, false }
+};
+#define BENCH_MODES (sizeof(modes) / sizeof(modes[0]))
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	const double x = *(const double*)a;
+	const double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int count, int p)
+{
+	return sorted[(count - 1) * p / 100];
+}
+
+static bool restart(const uint8 *movie, int movieSize)
+{
+	if (movie) return movie_play(movie, movieSize);
+
+	power_cycle();
+	return true;
+}
+
+static bool run_mode(const BenchMode *mode, int frames, const uint8 *movie, int movieSize, double *frameNs, BenchResult *r)
+{
+	uint32 *picture;
+	double start, cycles = 0;
+	int i;
+
+	if (!restart(movie, movieSize)) return false;
+
+	start = now_ns();
+	for (i=0; i<frames; ++i) {
+		const master_clock_t clockBefore = master_clock;
+		const double frameStart = now_ns();
+
+		run_frame(mode->render, mode->present);
+
+		frameNs[i] = now_ns() - frameStart;
+		// a power event in a movie starts the clock over
+		if (master_clock >= clockBefore) cycles += (double)(master_clock - clockBefore) / master_cycles_per_cpu_cycle;
+	}
+	r->seconds = (now_ns() - start) / 1e9;
+	r->cpu_cycles = cycles;
+
+	qsort(frameNs, frames, sizeof(double), compare_double);
+	r->p50 = percentile(frameNs, frames, 50) / 1e6;
+	r->p90 = percentile(frameNs, frames, 90) / 1e6;
+	r->p99 = percentile(frameNs, frames, 99) / 1e6;
+	r->max = frameNs[frames - 1] / 1e6;
+
+	// CPU only never draws, its picture is whatever the surface held
+	r->crc = 0;
+	if (mode->render) {
+		picture = (uint32*)malloc(screen.width * screen.height * sizeof(uint32));
+		if (!picture) return false;
+		host_frame_rgb(picture);
+		r->crc = crc32_update(0, picture, screen.width * screen.height * sizeof(uint32));
+		free(picture);
+	}
+
+	return true;
+}
+
+static bool check_kernels(int frames, const uint8 *movie, int movieSize)
+{
+	// every variant over the same frames, drawn with the tables and compared line by line
+	const tile_kernels *list[8];
+	const int n = tile_kernels_available(list, 8);
+	bool ok = true;
+	int i, f;
+
+	for (i=0; i<n; ++i) {
+		ppu_tile_kernels = list[i];
+		tile_kernels_check = true;
+		tile_kernels_mismatches = 0;
+
+		if (!restart(movie, movieSize)) return false;
+		for (f=0; f<frames; ++f) {
+			run_frame(true, false);
+		}
+
+		printf("%-8s %u lines differ\n", list[i]->name, tile_kernels_mismatches);
+		if (tile_kernels_mismatches) ok = false;
+	}
+
+	tile_kernels_check = false;
+	return ok;
+}
+
+static bool select_kernels(const char *name)
+{
+	const tile_kernels *list[8];
+	const int n = tile_kernels_available(list, 8);
+	int i;
+
+	if (!strcmp(name, "tables")) {
+		ppu_tile_kernels = NULL;
+		return true;
+	}
+	for (i=0; i<n; ++i) {
+		if (!strcmp(name, list[i]->name)) {
+			ppu_tile_kernels = list[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+static void print_json_string(const char *s)
+{
+	if (!s) {
+		printf("null");
+		return;
+	}
+
+	putchar('"');
+	for (; *s; ++s) {
+		if (*s == '"' || *s == '\\') {
+			printf("\\%c", *s);
+		} else if ((unsigned char)*s < 0x20) {
+			printf("\\u%04x", (unsigned char)*s);
+		} else {
+			putchar(*s);
+		}
+	}
+	putchar('"');
+}
+
+static void usage()
+{
+	printf("usage: nesbench [-f frames] [-m movie] [-k kernels] [-c] [-j] rom.nes\n"
+		"  -f frames   frames per mode (1800, or the movie's length)\n"
+		"  -m movie    play a movie, every mode from its start\n"
+		"  -k kernels  tile kernels to draw with, a variant name or tables (the fastest variant)\n"
+		"  -c          check the tile kernels against the renderer instead\n"
+		"  -j          JSON output\n");
+}
+
+int main(int argc, char **argv)
+{
+	BenchResult results[BENCH_MODES];
+	const uint8 *movie = NULL;
+	uint8 *movieCopy = NULL;
+	int movieSize = 0;
+	char *movieName = NULL;
+	char *rom = NULL;
+	char *kernels = NULL;
+	bool check = false;
+	bool json = false;
+	int frames = -1;
+	double *frameNs;
+	int i;
+
+	for (i=1; i<argc; ++i) {
+		if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			frames = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+			movieName = argv[++i];
+		} else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+			kernels = argv[++i];
+		} else if (!strcmp(argv[i], "-c")) {
+			check = true;
+		} else if (!strcmp(argv[i], "-j")) {
+			json = true;
+		} else if (argv[i][0] != '-' && !rom) {
+			rom = argv[i];
+		} else {
+			usage();
+			return 2;
+		}
+	}
+	if (!rom) {
+		usage();
+		return 2;
+	}
+
+	if (!load_game(rom)) {
+		fprintf(stderr, "%s: can't load the ROM\n", rom);
+		return 1;
+	}
+
+	if (movieName) {
+		if (!movie_load(movieName)) {
+			fprintf(stderr, "%s: not a movie for this ROM\n", movieName);
+			return 1;
+		}
+		// movie_play copies what it's given, a copy of our own outlives that
+		movie = movie_data(&movieSize);
+		movieCopy = (uint8*)malloc(movieSize);
+		if (!movieCopy) return 1;
+		memcpy(movieCopy, movie, movieSize);
+		movie = movieCopy;
+		if (frames < 0) frames = movie_frames();
+	}
+	if (frames < 0) frames = 1800;
+	if (frames <= 0) {
+		fprintf(stderr, "no frames to run\n");
+		return 1;
+	}
+
+	if (kernels && !select_kernels(kernels)) {
+		fprintf(stderr, "%s: no such tile kernels on this host\n", kernels);
+		return 1;
+	}
+	if (check) {
+		return check_kernels(frames, movie, movieSize) ? 0 : 1;
+	}
+
+	frameNs = (double*)malloc(frames * sizeof(double));
+	if (!frameNs) return 1;
+
+	for (i=0; i<(int)BENCH_MODES; ++i) {
+		if (!run_mode(&modes[i], frames, movie, movieSize, frameNs, &results[i])) {
+			fprintf(stderr, "%s: can't run\n", modes[i].name);
+			return 1;
+		}
+	}
+
+	if (json) {
+		printf("{\n\t\"rom\": ");
+		print_json_string(rom);
+		printf(",\n\t\"movie\": ");
+		print_json_string(movieName);
+		printf(",\n\t\"frames\": %d,\n\t\"kernels\": \"%s\",\n\t\"modes\": {\n", frames, ppu_tile_kernels ? ppu_tile_kernels->name : "tables");
+		for (i=0; i<(int)BENCH_MODES; ++i) {
+			const BenchResult *r = &results[i];
+
+			printf("\t\t\"%s\": {\"fps\": %.1f, \"cycles_per_sec\": %.0f, \"frame_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}, ",
+				modes[i].name, frames / r->seconds, r->cpu_cycles / r->seconds, r->p50, r->p90, r->p99, r->max);
+			if (modes[i].render) {
+				printf("\"crc\": \"%08x\"}", (unsigned)r->crc);
+			} else {
+				printf("\"crc\": null}");
+			}
+			printf("%s\n", (i + 1 < (int)BENCH_MODES) ? "," : "");
+		}
+		printf("\t}\n}\n");
+	} else {
+		printf("%s, %d frames%s%s, tile kernels: %s\n", rom, frames, movieName ? " of " : "", movieName ? movieName : "",
+			ppu_tile_kernels ? ppu_tile_kernels->name : "tables");
+		printf("%-18s %10s %14s %8s %8s %8s %8s  %s\n", "mode", "fps", "cycles/s", "p50 ms", "p90 ms", "p99 ms", "max ms", "crc");
+		for (i=0; i<(int)BENCH_MODES; ++i) {
+			const BenchResult *r = &results[i];
+
+			printf("%-18s %10.1f %14.0f %8.3f %8.3f %8.3f %8.3f  ",
+				modes[i].name, frames / r->seconds, r->cpu_cycles / r->seconds, r->p50, r->p90, r->p99, r->max);
+			if (modes[i].render) {
+				printf("%08x\n", (unsigned)r->crc);
+			} else {
+				printf("-\n");
+			}
+		}
+	}
+
+	free(frameNs);
+	free(movieCopy);
+	return 0;
+}